@@ -0,0 +1,275 @@
+#include "fb.h"
+#include "fb_blend.h"
+#include "fb_fill.h"
+#include "sprite.h"
+#include "ui.h"
+#include "wallpaper.h"
+#include "version.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Renderer microbenchmarks against the headless memory backend.
+   Output is one tab-separated line per case so runs can be diffed
+   between releases. */
+
+#define MAX_SAMPLES 4096
+
+typedef struct {
+    const char *name;
+    int cmatrix;            /* -1: not applicable, else the --cmatrix setting */
+    void (*run)(framebuffer_t *fb, int iter);
+    long (*pixels)(const framebuffer_t *fb);
+} bench_case_t;
+
+static const char *bench_text = "The quick brown fox jumps over the lazy dog";
+
+static long screen_pixels(const framebuffer_t *fb) {
+    return (long)fb->width * fb->height;
+}
+
+static long rect_pixels(const framebuffer_t *fb) {
+    return (long)(fb->width / 2) * (fb->height / 2);
+}
+
+static long text_pixels(const framebuffer_t *fb) {
+    return (long)strlen(bench_text) * fb->font->cell_w * fb->font->cell_h;
+}
+
+/* A 256x256 disc with a soft edge and transparent corners, like a logo */
+#define BENCH_SPRITE_SIZE 256
+static sprite_t bench_sprite;
+static uint8_t *bench_sprite_data;
+
+static long sprite_pixels(const framebuffer_t *fb) {
+    (void)fb;
+    return (long)BENCH_SPRITE_SIZE * BENCH_SPRITE_SIZE;
+}
+
+static int make_sprite(void) {
+    static uint32_t argb[BENCH_SPRITE_SIZE * BENCH_SPRITE_SIZE];
+    double r = BENCH_SPRITE_SIZE / 2.0, inner = (r - 16) * (r - 16);
+    for (int y = 0; y < BENCH_SPRITE_SIZE; y++) {
+        for (int x = 0; x < BENCH_SPRITE_SIZE; x++) {
+            double d2 = (x + 0.5 - r) * (x + 0.5 - r) + (y + 0.5 - r) * (y + 0.5 - r);
+            double a = d2 < inner ? 1.0 : d2 < r * r ? (r * r - d2) / (r * r - inner) : 0.0;
+            argb[y * BENCH_SPRITE_SIZE + x] = (uint32_t)(a * 255) << 24 | (uint32_t)(x ^ y) << 8 | 0xC00000;
+        }
+    }
+    size_t size = sprite_encode(argb, BENCH_SPRITE_SIZE, BENCH_SPRITE_SIZE, 1, &bench_sprite_data);
+    return size && sprite_from_memory(&bench_sprite, bench_sprite_data, size) == 0 ? 0 : -1;
+}
+
+/* A 2560x1600 gradient standing in for a decoded wallpaper */
+#define BENCH_WALLPAPER_W 2560
+#define BENCH_WALLPAPER_H 1600
+static uint32_t *bench_wallpaper;
+static uint32_t *bench_scaled;
+
+static int make_wallpaper(void) {
+    bench_wallpaper = malloc((size_t)BENCH_WALLPAPER_W * BENCH_WALLPAPER_H * 4);
+    bench_scaled = malloc((size_t)3840 * 2160 * 4);     /* the largest resolution */
+    if (!bench_wallpaper || !bench_scaled)
+        return -1;
+    for (int y = 0; y < BENCH_WALLPAPER_H; y++)
+        for (int x = 0; x < BENCH_WALLPAPER_W; x++)
+            bench_wallpaper[(size_t)y * BENCH_WALLPAPER_W + x] = (uint32_t)(x * 255 / BENCH_WALLPAPER_W) << 16 |
+                                                                 (uint32_t)(y * 255 / BENCH_WALLPAPER_H) << 8 |
+                                                                 ((x ^ y) & 0xFF);
+    return 0;
+}
+
+/* A premultiplied image as large as the benchmark rectangle at 4K, with
+   opaque, clear and translucent pixels mixed like a soft-edged overlay */
+#define BENCH_IMAGE_W 1920
+#define BENCH_IMAGE_H 1080
+static uint32_t *bench_image;
+
+static int make_image(void) {
+    bench_image = malloc((size_t)BENCH_IMAGE_W * BENCH_IMAGE_H * 4);
+    if (!bench_image)
+        return -1;
+    for (int y = 0; y < BENCH_IMAGE_H; y++) {
+        for (int x = 0; x < BENCH_IMAGE_W; x++) {
+            uint32_t a = (x / 64 + y / 64) % 3 == 0 ? 0 : (x / 64 + y / 64) % 3 == 1 ? 255 : (uint32_t)(x ^ y) & 0xFF;
+            bench_image[(size_t)y * BENCH_IMAGE_W + x] = a << 24 | fb_blend_scale(0x4080C0, a);
+        }
+    }
+    return 0;
+}
+
+static void run_clear(framebuffer_t *fb, int iter) {
+    fb_clear(fb, iter & 1 ? 0x202020 : 0x000000);
+}
+
+static void run_rect(framebuffer_t *fb, int iter) {
+    fb_draw_rect(fb, fb->width / 4, fb->height / 4, fb->width / 2, fb->height / 2,
+                 iter & 1 ? 0x336699 : 0x996633);
+}
+
+/* A translucent panel over half the screen */
+static void run_rect_blend(framebuffer_t *fb, int iter) {
+    fb_fill_rect_blend(fb, fb->width / 4, fb->height / 4, fb->width / 2, fb->height / 2,
+                       iter & 1 ? 0x336699 : 0x996633, 176);
+}
+
+/* The image composited as is, and faded to 60% */
+static void run_blit_blend(framebuffer_t *fb, int iter) {
+    (void)iter;
+    fb_blit_blend(fb, fb->width / 4, fb->height / 4, bench_image, BENCH_IMAGE_W, fb->width / 2,
+                  fb->height / 2, 255);
+}
+
+static void run_blit_faded(framebuffer_t *fb, int iter) {
+    (void)iter;
+    fb_blit_blend(fb, fb->width / 4, fb->height / 4, bench_image, BENCH_IMAGE_W, fb->width / 2,
+                  fb->height / 2, 153);
+}
+
+static void run_text(framebuffer_t *fb, int iter) {
+    fb_draw_text(fb, 16, fb->height / 2, bench_text, iter & 1 ? 0xFFFFFF : 0x00FF00);
+}
+
+/* Alpha-blend the sprite over the middle of the screen */
+static void run_sprite(framebuffer_t *fb, int iter) {
+    sprite_draw(fb, &bench_sprite, (fb->width - BENCH_SPRITE_SIZE) / 2 + (iter & 1),
+                (fb->height - BENCH_SPRITE_SIZE) / 2, NULL);
+}
+
+/* The one-time wallpaper scale to the screen size (what a cache miss costs) */
+static void run_wallpaper(framebuffer_t *fb, int iter) {
+    (void)iter;
+    wallpaper_scale(bench_scaled, fb->width, fb->height, bench_wallpaper, BENCH_WALLPAPER_W,
+                    BENCH_WALLPAPER_H);
+}
+
+/* A forced full repaint of the message screen: the base UI plus a present */
+static void run_base(framebuffer_t *fb, int iter) {
+    (void)iter;
+    ui_invalidate(fb);
+    ui_draw_message(fb, "");
+}
+
+/* Simulate typing: the username grows and shrinks by one character per frame */
+static void run_login(framebuffer_t *fb, int iter) {
+    static const char user[] = "benchmark-user-name";
+    char username[sizeof(user)];
+    int len = iter % (int)(sizeof(user) - 1);
+    memcpy(username, user, len);
+    username[len] = '\0';
+    ui_draw_login(fb, username, "hunter2", 0, len);
+}
+
+/* One frame of cmatrix rain over the login screen */
+static void run_rain(framebuffer_t *fb, int iter) {
+    if (iter == 0)
+        ui_draw_login(fb, "benchmark-user", "hunter2", 0, 14);
+    else
+        ui_animate(fb);
+}
+
+static const bench_case_t cases[] = {
+    { "fb_clear",       -1, run_clear, screen_pixels },
+    { "fb_draw_rect",   -1, run_rect,  rect_pixels },
+    { "fb_fill_rect_blend", -1, run_rect_blend, rect_pixels },
+    { "fb_blit_blend",  -1, run_blit_blend, rect_pixels },
+    { "fb_blit_faded",  -1, run_blit_faded, rect_pixels },
+    { "fb_draw_text",   -1, run_text,  text_pixels },
+    { "sprite_draw",    -1, run_sprite, sprite_pixels },
+    { "wallpaper_scale", -1, run_wallpaper, screen_pixels },
+    { "ui_draw_base",    0, run_base,  screen_pixels },
+    { "ui_draw_base",    1, run_base,  screen_pixels },
+    { "ui_draw_login",   0, run_login, screen_pixels },
+    { "ui_draw_login",   1, run_login, screen_pixels },
+    { "ui_animate",      1, run_rain,  screen_pixels },
+};
+
+static const struct { const char *name; int width, height; } resolutions[] = {
+    { "720p",  1280,  720 },
+    { "1080p", 1920, 1080 },
+    { "4k",    3840, 2160 },
+};
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* Run one case until the time budget or sample cap is reached */
+static void bench_run(const bench_case_t *bc, const char *res, framebuffer_t *fb,
+                      double budget_ns, int min_iters) {
+    static double samples[MAX_SAMPLES];
+    int n = 0;
+    double total = 0;
+
+    if (bc->cmatrix >= 0)
+        ui_set_cmatrix(bc->cmatrix);
+    bc->run(fb, 0);     /* warm-up: builds caches such as the background layer */
+    if (bc->cmatrix >= 0)
+        ui_tick(fb);    /* composes that layer, as the event loop would */
+    fb_present(fb);
+
+    while (n < MAX_SAMPLES && (n < min_iters || total < budget_ns)) {
+        double t0 = now_ns();
+        bc->run(fb, n + 1);
+        double t1 = now_ns();
+        fb_present(fb);   /* untimed for primitives; the ui cases present themselves */
+        samples[n++] = t1 - t0;
+        total += t1 - t0;
+    }
+    qsort(samples, n, sizeof(double), cmp_double);
+    double mean = total / n;
+    printf("%s\t%s\t%d\t%s\t%d\t%.3f\t%.1f\t%.1f\t%.1f\n",
+           bc->name, res, fb->bpp,
+           bc->cmatrix < 0 ? "-" : (bc->cmatrix ? "on" : "off"),
+           n, mean / bc->pixels(fb), 1e9 / mean,
+           samples[n / 2] / 1e3, samples[(n * 99) / 100] / 1e3);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [--engine avx2|sse2|scalar] [--bpp 16|24|32] [--budget-ms N]\n", prog);
+}
+
+int main(int argc, char **argv) {
+    int bpp = 32;
+    double budget_ms = 300;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--engine") == 0 && i + 1 < argc) {
+            if (fb_fill_select(argv[++i]) < 0 || fb_blend_select(argv[i]) < 0) {
+                fprintf(stderr, "Engine '%s' is not available on this CPU\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "--bpp") == 0 && i + 1 < argc) {
+            bpp = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--budget-ms") == 0 && i + 1 < argc) {
+            budget_ms = atof(argv[++i]);
+        } else {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (make_sprite() < 0 || make_wallpaper() < 0 || make_image() < 0)
+        return EXIT_FAILURE;
+    ui_set_wallpaper(NULL);     /* the ui cases measure the plain background */
+    printf("# fblogin-bench %s fill=%s blend=%s\n", FBLOGIN_VERSION, fb_fill_engine()->name,
+           fb_blend_engine()->name);
+    printf("case\tresolution\tbpp\tcmatrix\titerations\tns_per_pixel\tfps\tp50_us\tp99_us\n");
+    for (size_t r = 0; r < sizeof(resolutions) / sizeof(resolutions[0]); r++) {
+        framebuffer_t fb;
+        if (fb_init_memory(&fb, resolutions[r].width, resolutions[r].height, bpp) < 0)
+            return EXIT_FAILURE;
+        for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++)
+            bench_run(&cases[c], resolutions[r].name, &fb, budget_ms * 1e6, 10);
+        fb_close(&fb);
+    }
+    return 0;
+}
+
@@ -0,0 +1,36 @@
+#ifndef ACCOUNT_H
+#define ACCOUNT_H
+
+#include <sys/types.h>
+
+#define ACCOUNT_MAX_GROUPS 256
+#define ACCOUNT_SLOTS 16        /* requesters (seats) served in turn */
+
+/* Everything the login needs to know about a user, resolved ahead of time
+   so slow NSS backends (sssd, LDAP) stay off the critical path.  Cached
+   entries only steer the prompt and warm the caches below it; the session
+   is always started from a fresh account_resolve().  Fingerprint
+   enrollment is not kept here but asked of fprint_cached(), which follows
+   changes to the storage. */
+typedef struct {
+    char user[256];
+    int found;                  /* the passwd entry exists */
+    uid_t uid;
+    gid_t gid;
+    char dir[256];
+    char shell[256];
+    gid_t groups[ACCOUNT_MAX_GROUPS];
+    int ngroups;                /* -1: too many or unknown */
+    int home_ok;                /* the home directory exists */
+} account_t;
+
+int account_init(void);
+void account_close(void);
+int account_fd(void);
+void account_handle_events(void);
+
+int account_request(int slot, const char *user);
+int account_get(const char *user, account_t *acct);
+int account_resolve(const char *user, account_t *acct);
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef EVENT_H
+#define EVENT_H
+
+#include <signal.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* A file descriptor watched by the event loop.  Sources are owned by the
+   caller and must stay alive while registered. */
+typedef struct event_source {
+    int fd;
+    void (*handler)(struct event_source *src, uint32_t events);
+    void *data;         /* for the handler, e.g. the seat it belongs to */
+} event_source_t;
+
+typedef struct {
+    int epfd;
+} event_loop_t;
+
+int event_loop_init(event_loop_t *loop);
+void event_loop_close(event_loop_t *loop);
+int event_add(event_loop_t *loop, event_source_t *src, uint32_t events);
+int event_modify(event_loop_t *loop, event_source_t *src, uint32_t events);
+int event_remove(event_loop_t *loop, event_source_t *src);
+int event_dispatch(event_loop_t *loop, int timeout_ms);
+
+int event_timer_open(void);
+int event_timer_arm(int fd, int ms);
+void event_timer_ack(int fd);
+int event_signal_open(const sigset_t *mask, sigset_t *old_mask);
+int event_pidfd_open(pid_t pid);
+
+#endif
+
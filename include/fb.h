@@ -4,23 +4,96 @@
 #include <stdint.h>
 #include <stddef.h>
 #include <stdlib.h>
+#include <linux/fb.h>
+#include "font.h"
+
+/* Maximum number of disjoint dirty rectangles tracked between presents.
+   Further damage is merged into the closest existing rectangle. */
+#define FB_MAX_DAMAGE 64
+
+typedef struct {
+    int x;
+    int y;
+    int w;
+    int h;
+} fb_rect_t;
+
+/* Pixel layout taken from the driver's red/green/blue bitfields */
+typedef struct {
+    int bytes_per_pixel;
+    uint8_t red_offset, red_length;
+    uint8_t green_offset, green_length;
+    uint8_t blue_offset, blue_length;
+} fb_format_t;
+
+struct fb_ops;
+struct fb_backend;
 
 typedef struct {
+    const struct fb_backend *backend;   /* fbdev device or headless memory target */
     int fb_fd;
     uint8_t *fb_ptr;
     size_t fb_size;
     int width;
     int height;
     int bpp;
+    fb_format_t format;
+    const struct fb_ops *ops;   /* fill/span/glyph kernels for this format */
+    const font_atlas_t *font;   /* glyph atlas at the scale picked for this resolution */
+    uint8_t *vram;              /* first visible pixel (honours xoffset/yoffset) */
+    size_t vram_stride;         /* line_length reported by the driver */
+    uint8_t *shadow;            /* system-RAM back buffer, NULL when drawing straight to VRAM */
+    uint8_t *draw_ptr;          /* where primitives draw: shadow if present, else vram */
+    size_t stride;              /* bytes per row of draw_ptr */
+    fb_rect_t damage[FB_MAX_DAMAGE];
+    int damage_count;
+    struct fb_var_screeninfo vinfo;      /* cached at init; yoffset tracks the front page */
+    struct fb_var_screeninfo orig_vinfo; /* restored on close */
+    int vinfo_changed;                   /* yres_virtual was grown to make room for a second page */
+    int pages;                           /* 2 when page flipping, 1 for a single blit target */
+    int front;                           /* page currently scanned out */
+    int vsync;                           /* wait for vblank before flipping */
+    fb_rect_t prev_damage[FB_MAX_DAMAGE]; /* last frame's damage, not yet on the back page */
+    int prev_damage_count;
 } framebuffer_t;
 
+/* An off-screen copy of the screen in the framebuffer's own pixel format,
+   restored with straight row copies */
+typedef struct {
+    uint8_t *pixels;
+    int width;
+    int height;
+    size_t stride;
+} fb_layer_t;
+
 int fb_init(framebuffer_t *fb, const char *fb_device);
+int fb_init_memory(framebuffer_t *fb, int width, int height, int bpp);
 void fb_close(framebuffer_t *fb);
+void fb_release(framebuffer_t *fb);
+int fb_acquire(framebuffer_t *fb);
+int fb_dump_ppm(const framebuffer_t *fb, const char *path);
+uint32_t fb_map_rgb(const framebuffer_t *fb, uint32_t rgb);
+uint32_t fb_unmap_rgb(const framebuffer_t *fb, uint32_t pixel);
+void fb_damage(framebuffer_t *fb, int x, int y, int w, int h);
+void fb_present(framebuffer_t *fb);
 void fb_clear(framebuffer_t *fb, uint32_t color);
 void fb_draw_pixel(framebuffer_t *fb, int x, int y, uint32_t color);
 void fb_draw_rect(framebuffer_t *fb, int x, int y, int w, int h, uint32_t color);
 void fb_draw_rect_outline(framebuffer_t *fb, int x, int y, int w, int h, uint32_t color);
+void fb_fill_rect_blend(framebuffer_t *fb, int x, int y, int w, int h, uint32_t color, uint32_t alpha);
+void fb_blit_blend(framebuffer_t *fb, int x, int y, const uint32_t *pixels, int stride,
+                   int w, int h, uint32_t alpha);
+void fb_blend_span(framebuffer_t *fb, uint8_t *dst, const uint32_t *src, int n);
+void fb_scroll_rect(framebuffer_t *fb, int x, int y, int w, int h, int dy);
+int fb_text_width(const framebuffer_t *fb, const char *text);
 void fb_draw_text(framebuffer_t *fb, int x, int y, const char *text, uint32_t color);
+void fb_draw_text_outlined(framebuffer_t *fb, int x, int y, const char *text,
+                           uint32_t color, uint32_t outline_color, int radius);
+int fb_layer_alloc(const framebuffer_t *fb, fb_layer_t *layer);
+int fb_layer_capture(framebuffer_t *fb, fb_layer_t *layer);
+void fb_layer_restore(framebuffer_t *fb, const fb_layer_t *layer, int x, int y, int w, int h);
+void fb_layer_view(const framebuffer_t *fb, fb_layer_t *layer, framebuffer_t *view);
+void fb_layer_free(fb_layer_t *layer);
 
 #endif
 
@@ -0,0 +1,27 @@
+#ifndef FB_BACKEND_H
+#define FB_BACKEND_H
+
+#include "fb.h"
+
+/* A render target.  init() fills in geometry, pixel format and the visible
+   surface (vram/vram_stride); fb.c then adds the shadow buffer, kernels and
+   font.  present() publishes fb->damage; close() releases the target.
+   release() and acquire() lend the display to someone else and take it
+   back while the mapping stays; either may be NULL. */
+typedef struct fb_backend {
+    const char *name;
+    int (*init)(framebuffer_t *fb, const char *spec);
+    void (*present)(framebuffer_t *fb);
+    void (*close)(framebuffer_t *fb);
+    void (*release)(framebuffer_t *fb);
+    int (*acquire)(framebuffer_t *fb);
+} fb_backend_t;
+
+extern const fb_backend_t fb_backend_fbdev;
+extern const fb_backend_t fb_backend_memory;
+
+void fb_copy_rects(const framebuffer_t *fb, uint8_t *dst_base, size_t dst_stride,
+                   const fb_rect_t *rects, int count);
+
+#endif
+
@@ -0,0 +1,48 @@
+#ifndef FB_BLEND_H
+#define FB_BLEND_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Alpha blending kernels, chosen once at runtime from the CPU's features
+   like the fill engine.  over() composites premultiplied 0xAARRGGBB
+   pixels onto 8-bit-per-channel destination pixels in the same channel
+   order: dst = src + dst * (255 - alpha) / 255, rounded, per channel.
+   tint() is over() with the same source pixel everywhere, and scale()
+   multiplies every channel of src, alpha included, by a/255 (the
+   opacity of a whole image).  lerp() mixes two rows of 8888 pixels, w/128
+   of b (w in 0..128), as fb_blend_lerp() does for one pixel. */
+typedef struct {
+    const char *name;
+    void (*over)(uint32_t *dst, const uint32_t *src, size_t n);
+    void (*tint)(uint32_t *dst, uint32_t src, size_t n);
+    void (*scale)(uint32_t *dst, const uint32_t *src, size_t n, unsigned a);
+    void (*lerp)(uint32_t *dst, const uint32_t *a, const uint32_t *b, size_t n, unsigned w);
+} fb_blend_engine_t;
+
+const fb_blend_engine_t *fb_blend_engine(void);
+int fb_blend_select(const char *name);
+
+/* Scale one 8888 pixel's channels by inv/255 (0..255), rounded exactly as
+   the vector kernels do */
+static inline uint32_t fb_blend_scale(uint32_t pixel, uint32_t inv) {
+    uint32_t rb = (pixel & 0x00FF00FF) * inv + 0x00800080;
+    uint32_t ag = ((pixel >> 8) & 0x00FF00FF) * inv + 0x00800080;
+    rb = ((rb + ((rb >> 8) & 0x00FF00FF)) >> 8) & 0x00FF00FF;
+    ag = (ag + ((ag >> 8) & 0x00FF00FF)) & 0xFF00FF00;
+    return rb | ag;
+}
+
+/* Premultiplied source-over for one pixel */
+static inline uint32_t fb_blend_pixel(uint32_t dst, uint32_t src) {
+    return src + fb_blend_scale(dst, 255 - (src >> 24));
+}
+
+/* Mix two 8888 pixels per channel: (a * (128 - w) + b * w + 64) / 128 */
+static inline uint32_t fb_blend_lerp(uint32_t a, uint32_t b, unsigned w) {
+    uint32_t rb = ((a & 0x00FF00FF) * (128 - w) + (b & 0x00FF00FF) * w + 0x00400040) >> 7;
+    uint32_t ag = ((a >> 8) & 0x00FF00FF) * (128 - w) + ((b >> 8) & 0x00FF00FF) * w + 0x00400040;
+    return (rb & 0x00FF00FF) | ((ag << 1) & 0xFF00FF00);
+}
+
+#endif
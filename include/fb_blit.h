@@ -0,0 +1,30 @@
+#ifndef FB_BLIT_H
+#define FB_BLIT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Per-format pixel kernels.  Callers clip once per primitive and hand the
+   kernels a pointer to the first pixel, so the inner loops carry neither
+   format nor bounds checks. */
+typedef struct fb_ops {
+    int bytes_per_pixel;
+    void (*fill_span)(uint8_t *dst, int n, uint32_t pixel);
+    void (*fill_rect)(uint8_t *dst, size_t stride, int w, int h, uint32_t pixel);
+    void (*glyph)(uint8_t *dst, size_t stride, const uint64_t *rows, int nrows, uint32_t pixel);
+} fb_ops_t;
+
+/* Pop the lowest run of set bits from a coverage mask: returns its length
+   and stores its first bit in *start.  Works for runs touching bit 63. */
+static inline int fb_next_run(uint64_t *bits, int *start) {
+    uint64_t next = *bits + (*bits & -*bits);
+    int end = next ? __builtin_ctzll(next) : 64;
+    *start = __builtin_ctzll(*bits);
+    *bits &= next;
+    return end - *start;
+}
+
+const fb_ops_t *fb_ops_for_bpp(int bits_per_pixel);
+
+#endif
+
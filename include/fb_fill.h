@@ -0,0 +1,27 @@
+#ifndef FB_FILL_H
+#define FB_FILL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Fills at least this large bypass the cache with non-temporal stores;
+   smaller ones are likely to be read back (blended over, presented) soon. */
+#define FB_FILL_NT_THRESHOLD (1024 * 1024)
+
+/* Span fill kernels, chosen once at runtime from the CPU's features */
+typedef struct {
+    const char *name;
+    void (*span)(uint32_t *dst, size_t n, uint32_t value);
+    void (*span_nt)(uint32_t *dst, size_t n, uint32_t value);
+} fb_fill_engine_t;
+
+const fb_fill_engine_t *fb_fill_engine(void);
+int fb_fill_select(const char *name);
+
+void fb_fill_span16(uint8_t *dst, int n, uint32_t pixel);
+void fb_fill_span32(uint8_t *dst, int n, uint32_t pixel);
+void fb_fill_rect16(uint8_t *dst, size_t stride, int w, int h, uint32_t pixel);
+void fb_fill_rect32(uint8_t *dst, size_t stride, int w, int h, uint32_t pixel);
+
+#endif
+
@@ -0,0 +1,51 @@
+#ifndef FONT_H
+#define FONT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define FONT_GLYPHS 128
+/* Cells are at most 48 px wide so a glyph row (plus an outline) fits a uint64_t */
+#define FONT_MAX_SCALE 6
+
+/* The 8x8 font pre-scaled once: every glyph row is a coverage mask where
+   bit n set means pixel n of the cell is inked. */
+typedef struct {
+    int scale;
+    int cell_w;
+    int cell_h;
+    uint64_t *rows;                 /* FONT_GLYPHS * cell_h masks */
+    uint8_t first_row[FONT_GLYPHS]; /* inked row range per glyph, to skip blank rows */
+    uint8_t last_row[FONT_GLYPHS];
+} font_atlas_t;
+
+/* Largest outline radius; cell_w + 2 * radius must still fit in 64 bits */
+#define FONT_MAX_OUTLINE 8
+
+/* Glyphs dilated by `radius` pixels (square neighbourhood), in a frame that
+   starts radius pixels left of and above the glyph cell. */
+typedef struct {
+    int radius;
+    int cell_w;                     /* atlas cell_w + 2 * radius */
+    int cell_h;
+    uint64_t *rows;                 /* FONT_GLYPHS * cell_h masks */
+} font_outline_t;
+
+int font_scale_for_height(int height);
+const font_atlas_t *font_atlas_get(int scale);
+const font_outline_t *font_outline_get(const font_atlas_t *font, int radius);
+
+static inline const uint64_t *font_glyph_rows(const font_atlas_t *font, unsigned char c) {
+    if (c >= FONT_GLYPHS)
+        c = '?';
+    return font->rows + (size_t)c * font->cell_h;
+}
+
+static inline const uint64_t *font_outline_rows(const font_outline_t *outline, unsigned char c) {
+    if (c >= FONT_GLYPHS)
+        c = '?';
+    return outline->rows + (size_t)c * outline->cell_h;
+}
+
+#endif
+
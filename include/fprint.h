@@ -0,0 +1,19 @@
+#ifndef FPRINT_H
+#define FPRINT_H
+
+#include <stddef.h>
+
+/* Enrolled-finger lookups, cached per user.  Entries expire after a TTL and
+   are flushed early when the fprintd storage directory changes, watched
+   through an inotify descriptor the caller adds to its event loop. */
+int fprint_init(void);
+void fprint_close(void);
+int fprint_fd(void);
+void fprint_handle_events(void);
+
+int fprint_available(void);
+int fprint_lookup(const char *username, char *finger, size_t size);
+int fprint_cached(const char *username, char *finger, size_t size);
+void fprint_prefetch_recent(int max_users);
+
+#endif
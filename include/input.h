@@ -1,9 +1,59 @@
 #ifndef INPUT_H
 #define INPUT_H
 
-int input_init();
-int input_restore();
-int input_getchar();
+#include <stdint.h>
+#include <termios.h>
+
+/* Decoded keys.  Control characters without a dedicated type arrive as
+   KEY_CTRL with their byte value (e.g. 4 for Ctrl-D). */
+typedef enum {
+    KEY_CHAR,           /* printable Unicode code point */
+    KEY_CTRL,
+    KEY_ENTER,
+    KEY_TAB,
+    KEY_BACKSPACE,
+    KEY_DELETE,
+    KEY_LEFT,
+    KEY_RIGHT,
+    KEY_UP,
+    KEY_DOWN,
+    KEY_HOME,
+    KEY_END,
+    KEY_ESCAPE
+} key_type_t;
+
+typedef struct {
+    key_type_t type;
+    uint32_t code;      /* KEY_CHAR: code point, KEY_CTRL: byte */
+} key_event_t;
+
+/* A UTF-8 line being edited, with the cursor on a code point boundary */
+#define INPUT_FIELD_MAX 256
+
+typedef struct {
+    char text[INPUT_FIELD_MAX];
+    int len;            /* bytes */
+    int cursor;         /* byte offset */
+} input_field_t;
+
+/* A keyboard: the terminal it reads from, its settings before we took it
+   over and bytes of an escape sequence or UTF-8 character split across
+   reads.  Anything that is not a terminal is read as is. */
+typedef struct {
+    int fd;
+    int is_tty;
+    struct termios orig_termios;
+    unsigned char pending[8];
+    int pending_len;
+} input_t;
+
+int input_init(input_t *in, int fd, int signals);
+int input_restore(input_t *in);
+int input_read(input_t *in, key_event_t *keys, int max);
+
+void input_field_clear(input_field_t *field);
+int input_field_edit(input_field_t *field, const key_event_t *key);
+int input_field_chars(const input_field_t *field, int bytes);
 
 #endif
 
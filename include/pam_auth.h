@@ -1,7 +1,44 @@
 #ifndef PAM_AUTH_H
 #define PAM_AUTH_H
 
-int authenticate_user(const char *username, const char *password);
+/* Asynchronous authentication: the PAM transaction runs on a worker thread
+   and everything it has to say arrives as events on auth_fd().  The typed
+   password answers the first hidden prompt; any further prompt (a one-time
+   code, an expired password change) is handed to the UI and the worker
+   waits for auth_respond().  Each seat has an auth_t and a worker of its
+   own, so several logins can be in flight at once; their PAM calls take
+   turns, but a seat waiting on its user never holds up another. */
+typedef enum {
+    AUTH_PROMPT,        /* PAM asks a question; answer with auth_respond() */
+    AUTH_INFO,          /* PAM_TEXT_INFO */
+    AUTH_ERROR,         /* PAM_ERROR_MSG */
+    AUTH_DONE           /* finished: result is 0 on success, -1 on failure,
+                           and a failure locks out retries for delay_ms */
+} auth_event_type_t;
 
-#endif
+typedef struct {
+    auth_event_type_t type;
+    int echo;           /* AUTH_PROMPT: the answer may be shown */
+    int result;         /* AUTH_DONE */
+    int delay_ms;       /* AUTH_DONE */
+    char text[256];
+} auth_event_t;
+
+struct auth_session;
+
+typedef struct {
+    int efd;
+    char tty[64];                   /* PAM_TTY */
+    struct auth_session *current;
+    struct auth_session *queued;    /* for the worker, once it is free */
+    int worker_running;
+} auth_t;
 
+int auth_init(auth_t *auth, const char *tty);
+int auth_fd(const auth_t *auth);
+int auth_begin(auth_t *auth, const char *username, const char *password);
+int auth_next(auth_t *auth, auth_event_t *ev);
+void auth_respond(auth_t *auth, const char *answer);
+void auth_cancel(auth_t *auth);
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef RAIN_H
+#define RAIN_H
+
+#include "fb.h"
+
+/* cmatrix-style rain.  Each column carries a falling streak of glyphs,
+   shaded from a bright head to a dim tail; a step scrolls the streak's
+   pixels down one cell and draws only the cells that change. */
+#define RAIN_FPS 30
+#define RAIN_MAX_TRAIL 32
+
+typedef struct {
+    int head;           /* cell row of the head glyph; negative while waiting to enter */
+    int trail;          /* glyphs in the streak, head included */
+    int speed;          /* ticks per step */
+    int wait;           /* ticks until the next step */
+    uint32_t rng;       /* xorshift32 state */
+} rain_column_t;
+
+typedef struct {
+    int cols;
+    int rows;
+    int cell_w;
+    int cell_h;
+    rain_column_t *columns;
+    fb_rect_t *changed;     /* one strip per column moved by the last tick */
+    int changed_count;
+} rain_t;
+
+int rain_init(rain_t *rain, framebuffer_t *view, uint32_t seed);
+void rain_tick(rain_t *rain, framebuffer_t *view);
+void rain_free(rain_t *rain);
+
+#endif
+
@@ -0,0 +1,49 @@
+#ifndef SPRITE_H
+#define SPRITE_H
+
+#include "fb.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#define SPRITE_DIR "/usr/share/fblogin"
+#define SPRITE_MAGIC "FBS1"
+#define SPRITE_MAX_SIZE 4096        /* pixels per side */
+
+/* Header flags */
+#define SPRITE_RLE 0x1              /* rows are runs, see below */
+
+/* A .fbs file is used as is, straight from its mapping: a header, one
+   32-bit byte offset per row (from the start of the file, 4-aligned),
+   then the rows.  Pixels are premultiplied 0xAARRGGBB words in host
+   (little-endian) order.  A plain row is width pixels.  An RLE row is a
+   sequence of run words, each (count << 16 | skip): skip transparent
+   pixels, then count pixels that follow the word; skips and counts add
+   up to exactly width. */
+typedef struct {
+    char magic[4];
+    uint16_t width;
+    uint16_t height;
+    uint32_t flags;
+} sprite_header_t;
+
+typedef struct sprite {
+    int width;
+    int height;
+    int rle;
+    const uint8_t *data;            /* the whole file */
+    size_t size;
+    const uint32_t *rows;           /* row offsets into data */
+    /* Open files are shared by path */
+    char path[256];
+    int refs;
+    int mapped;                     /* data is an mmap to undo on close */
+    struct sprite *next;
+} sprite_t;
+
+sprite_t *sprite_open(const char *path);
+void sprite_close(sprite_t *sprite);
+int sprite_from_memory(sprite_t *sprite, const void *data, size_t size);
+void sprite_draw(framebuffer_t *fb, const sprite_t *sprite, int x, int y, const fb_rect_t *clip);
+size_t sprite_encode(const uint32_t *argb, int width, int height, int rle, uint8_t **out);
+
+#endif
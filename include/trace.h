@@ -0,0 +1,52 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+/* Low-overhead per-stage timing.  When tracing is off every hook is a
+   single branch on trace_enabled. */
+typedef enum {
+    TRACE_INPUT,        /* a key arrived (instant) */
+    TRACE_FRAME,        /* one complete ui_draw_* call */
+    TRACE_BASE,         /* background, title and logo */
+    TRACE_TEXT,         /* glyph rasterisation */
+    TRACE_PRESENT,      /* copying damage out of the shadow buffer */
+    TRACE_FLIP,         /* vsync wait plus FBIOPAN_DISPLAY */
+    TRACE_AUTH,         /* PAM or fingerprint verification */
+    TRACE_LATENCY,      /* key arrival to the next presented frame */
+    TRACE_STAGE_COUNT
+} trace_stage_t;
+
+/* Startup milestones, each recorded the first time it is reached */
+typedef enum {
+    TRACE_MARK_MAIN,            /* options parsed */
+    TRACE_MARK_FB,              /* framebuffers mapped */
+    TRACE_MARK_LOOP,            /* input and the event loop ready */
+    TRACE_MARK_FIRST_FRAME,     /* a usable prompt is on every screen */
+    TRACE_MARK_WORKERS,         /* fprintd and account workers started */
+    TRACE_MARK_BACKGROUND,      /* background layer composed */
+    TRACE_MARK_WARM,            /* NSS and enrollment caches warmed */
+    TRACE_MARK_COUNT
+} trace_mark_t;
+
+extern int trace_enabled;
+
+void trace_enable(const char *path);
+uint64_t trace_now(void);
+void trace_record(trace_stage_t stage, uint64_t start_ns, uint64_t end_ns);
+void trace_input(void);
+void trace_presented(void);
+int trace_mark(trace_mark_t mark);
+int trace_dump(void);
+
+static inline uint64_t trace_begin(void) {
+    return trace_enabled ? trace_now() : 0;
+}
+
+static inline void trace_end(trace_stage_t stage, uint64_t start_ns) {
+    if (trace_enabled)
+        trace_record(stage, start_ns, trace_now());
+}
+
+#endif
+
@@ -3,11 +3,21 @@
 
 #include "fb.h"
 
-void ui_draw_login(framebuffer_t *fb, const char *username, const char *password);
+/* Screens (framebuffers) the UI keeps state for at the same time */
+#define UI_MAX_SEATS 16
+
+void ui_draw_login(framebuffer_t *fb, const char *username, const char *password,
+                   int active, int cursor);
 void ui_draw_error(framebuffer_t *fb, const char *message);
 void ui_draw_welcome(framebuffer_t *fb, const char *username);
 void ui_draw_message(framebuffer_t *fb, const char *msg);
+void ui_toast(framebuffer_t *fb, const char *message, int ms);
 void ui_set_cmatrix(int flag);
+void ui_set_wallpaper(const char *path);
+void ui_set_status(framebuffer_t *fb, const char *status);
+void ui_invalidate(framebuffer_t *fb);
+int ui_tick(framebuffer_t *fb);
+void ui_animate(framebuffer_t *fb);
 
 #endif
 
@@ -0,0 +1,59 @@
+#ifndef WALLPAPER_H
+#define WALLPAPER_H
+
+#include "fb.h"
+#include "sprite.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#define WALLPAPER_PATH SPRITE_DIR "/wallpaper"   /* default source, PPM or QOI */
+#define WALLPAPER_CACHE_DIR "/var/cache/fblogin"
+#define WALLPAPER_MAGIC "FBW2"                  /* bump when the scaler or header changes */
+#define WALLPAPER_MAX_SIZE 16384                /* source pixels per side */
+
+/* What stat() says about the source a cache file was made from; when it
+   still matches, the source is taken as unchanged without reading it. */
+typedef struct {
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    int64_t mtime;
+    uint32_t mtime_nsec;
+    uint32_t reserved;
+} wallpaper_source_t;
+
+/* A cache file is a header and then the scaled picture in the framebuffer's
+   own pixel format, width * bytes_per_pixel bytes per row.  It is named
+   after the screen it was made for (see wallpaper_open()), so screens of
+   different sizes or formats keep separate copies; the header says which
+   source it holds. */
+typedef struct {
+    char magic[4];
+    uint32_t width;
+    uint32_t height;
+    uint8_t bytes_per_pixel;
+    uint8_t red_offset, red_length;
+    uint8_t green_offset, green_length;
+    uint8_t blue_offset, blue_length;
+    uint8_t reserved[5];
+    uint64_t source;                            /* FNV-1a of the source file */
+    wallpaper_source_t stat;
+} wallpaper_header_t;
+
+/* A wallpaper ready to present: the picture as a layer, restored onto the
+   screen with straight row copies.  The pixels are a mapping of the cache
+   file, or a private buffer when the cache could not be written. */
+typedef struct {
+    fb_layer_t layer;
+    void *data;
+    size_t size;
+    int mapped;
+} wallpaper_t;
+
+int wallpaper_open(wallpaper_t *wp, const char *path, const framebuffer_t *fb, int build);
+void wallpaper_close(wallpaper_t *wp);
+uint32_t *wallpaper_decode(const uint8_t *data, size_t size, int *width, int *height);
+int wallpaper_scale(uint32_t *dst, int width, int height, const uint32_t *src, int src_width,
+                    int src_height);
+
+#endif
@@ -0,0 +1,240 @@
+#include "account.h"
+#include "fprint.h"
+#include <errno.h>
+#include <grp.h>
+#include <pthread.h>
+#include <pwd.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define ACCOUNT_CACHE_SIZE ACCOUNT_SLOTS
+#define ACCOUNT_PREFETCH_USERS 3
+#define ACCOUNT_TTL 60              /* seconds a finished lookup steers the prompt */
+#define ACCOUNT_MISS_TTL 5          /* ... and a user that does not exist, just
+                                       long enough to answer the next Enter */
+
+/* One worker thread, shared by every seat, resolves the latest user each
+   seat asked for, taking the seats in turn; a seat's older request that
+   was never started is simply replaced.  Finished results land in a small
+   cache and the worker bumps an eventfd so the event loop hears about
+   them. */
+static pthread_t account_thread;
+static pthread_mutex_t account_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t account_cond = PTHREAD_COND_INITIALIZER;
+static char account_wanted[ACCOUNT_SLOTS][256];
+static int account_pending[ACCOUNT_SLOTS];
+static int account_turn;            /* the slot looked at first next time */
+static char account_active[256];    /* being resolved right now */
+static int account_quit;
+static int account_running;
+static int account_efd = -1;
+static account_t account_cache[ACCOUNT_CACHE_SIZE];
+static time_t account_expires[ACCOUNT_CACHE_SIZE];
+static int account_next;
+
+static time_t account_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+/* Public: Look a user up now: passwd entry, supplementary groups and home
+   directory.  Returns 0 if the user exists, -1 otherwise (acct->found
+   says the same). */
+int account_resolve(const char *user, account_t *acct) {
+    memset(acct, 0, sizeof(*acct));
+    snprintf(acct->user, sizeof(acct->user), "%s", user);
+    acct->ngroups = -1;
+
+    struct passwd pw, *result = NULL;
+    long size = sysconf(_SC_GETPW_R_SIZE_MAX);
+    if (size < 1024)
+        size = 16384;
+    char *buf = malloc(size);
+    if (!buf)
+        return -1;
+    int err;
+    while ((err = getpwnam_r(user, &pw, buf, size, &result)) == ERANGE && size < (1 << 20)) {
+        char *bigger = realloc(buf, size *= 2);
+        if (!bigger)
+            break;
+        buf = bigger;
+    }
+    if (err != 0 || !result) {
+        free(buf);
+        return -1;
+    }
+    acct->found = 1;
+    acct->uid = pw.pw_uid;
+    acct->gid = pw.pw_gid;
+    snprintf(acct->dir, sizeof(acct->dir), "%s", pw.pw_dir ? pw.pw_dir : "");
+    snprintf(acct->shell, sizeof(acct->shell), "%s", pw.pw_shell ? pw.pw_shell : "");
+    free(buf);
+
+    int ngroups = ACCOUNT_MAX_GROUPS;
+    if (getgrouplist(user, acct->gid, acct->groups, &ngroups) >= 0)
+        acct->ngroups = ngroups;
+
+    /* Also pulls an automounted or network home into the caches */
+    struct stat st;
+    acct->home_ok = acct->dir[0] && stat(acct->dir, &st) == 0 && S_ISDIR(st.st_mode);
+    return 0;
+}
+
+/* Internal: Take the next request off the slots (lock held).  Returns 0,
+   or -1 if none is pending. */
+static int account_take(void) {
+    for (int i = 0; i < ACCOUNT_SLOTS; i++) {
+        int slot = (account_turn + i) % ACCOUNT_SLOTS;
+        if (account_pending[slot]) {
+            memcpy(account_active, account_wanted[slot], sizeof(account_active));
+            account_pending[slot] = 0;
+            account_turn = (slot + 1) % ACCOUNT_SLOTS;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/* Internal: Load the NSS modules (libnss_* for passwd and group) so the
+   first real lookup does not pay for it */
+static void account_warm_nss(void) {
+    struct passwd pw, *result;
+    char buf[4096];
+    getpwuid_r(0, &pw, buf, sizeof(buf), &result);
+    struct group gr, *gresult;
+    getgrgid_r(0, &gr, buf, sizeof(buf), &gresult);
+}
+
+static void *account_worker(void *arg) {
+    (void)arg;
+    /* Warm NSS and the enrollment cache for the usual users before
+       anything else, then say so: the first wake-up marks the warm-up done */
+    account_warm_nss();
+    fprint_prefetch_recent(ACCOUNT_PREFETCH_USERS);
+    uint64_t one = 1;
+    if (write(account_efd, &one, sizeof(one)) < 0)
+        perror("write eventfd");
+
+    pthread_mutex_lock(&account_lock);
+    for (;;) {
+        while (!account_quit && account_take() < 0)
+            pthread_cond_wait(&account_cond, &account_lock);
+        if (account_quit)
+            break;
+        pthread_mutex_unlock(&account_lock);
+
+        account_t acct;
+        account_resolve(account_active, &acct);
+        /* Enrollment lives in the fprint cache; this only fills it */
+        char finger[64];
+        if (acct.found && fprint_available())
+            fprint_lookup(account_active, finger, sizeof(finger));
+
+        pthread_mutex_lock(&account_lock);
+        account_active[0] = '\0';
+        account_cache[account_next] = acct;
+        account_expires[account_next] =
+            account_now() + (acct.found ? ACCOUNT_TTL : ACCOUNT_MISS_TTL);
+        account_next = (account_next + 1) % ACCOUNT_CACHE_SIZE;
+        if (write(account_efd, &one, sizeof(one)) < 0)
+            perror("write eventfd");
+    }
+    pthread_mutex_unlock(&account_lock);
+    return NULL;
+}
+
+/* Public: Start the worker.  Signals the event loop handles through a
+   signalfd must already be blocked, so the thread inherits the mask. */
+int account_init(void) {
+    account_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (account_efd < 0) {
+        perror("eventfd");
+        return -1;
+    }
+    int err = pthread_create(&account_thread, NULL, account_worker, NULL);
+    if (err != 0) {
+        errno = err;
+        perror("pthread_create");
+        close(account_efd);
+        account_efd = -1;
+        return -1;
+    }
+    account_running = 1;
+    return 0;
+}
+
+/* Public: Stop the worker, waiting for a lookup in progress to finish */
+void account_close(void) {
+    if (account_running) {
+        pthread_mutex_lock(&account_lock);
+        account_quit = 1;
+        pthread_cond_signal(&account_cond);
+        pthread_mutex_unlock(&account_lock);
+        pthread_join(account_thread, NULL);
+        account_running = 0;
+    }
+    if (account_efd >= 0)
+        close(account_efd);
+    account_efd = -1;
+}
+
+/* Public: The eventfd that becomes readable when a lookup finishes */
+int account_fd(void) {
+    return account_efd;
+}
+
+void account_handle_events(void) {
+    uint64_t count;
+    if (read(account_efd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        perror("read eventfd");
+}
+
+/* Internal: The fresh cached result for a user, if any (lock held).  An
+   entry whose enrollment the fprint cache has since forgotten is stale. */
+static account_t *account_find(const char *user) {
+    time_t now = account_now();
+    for (int i = 0; i < ACCOUNT_CACHE_SIZE; i++) {
+        account_t *a = &account_cache[i];
+        if (account_expires[i] > now && strcmp(a->user, user) == 0) {
+            if (a->found && fprint_available() && fprint_cached(user, NULL, 0) < 0)
+                return NULL;
+            return a;
+        }
+    }
+    return NULL;
+}
+
+/* Public: Ask the worker to resolve a user on behalf of a seat (slot),
+   unless it already has.  Returns -1 if there is no worker to ask. */
+int account_request(int slot, const char *user) {
+    if (!account_running)
+        return -1;
+    if (!user[0])
+        return 0;
+    slot %= ACCOUNT_SLOTS;
+    pthread_mutex_lock(&account_lock);
+    if (!account_find(user) && strcmp(account_active, user) != 0) {
+        snprintf(account_wanted[slot], sizeof(account_wanted[slot]), "%s", user);
+        account_pending[slot] = 1;
+        pthread_cond_signal(&account_cond);
+    }
+    pthread_mutex_unlock(&account_lock);
+    return 0;
+}
+
+/* Public: Copy out a finished lookup.  Returns 0, or -1 if there is none */
+int account_get(const char *user, account_t *acct) {
+    pthread_mutex_lock(&account_lock);
+    account_t *hit = account_find(user);
+    if (hit)
+        *acct = *hit;
+    pthread_mutex_unlock(&account_lock);
+    return hit ? 0 : -1;
+}
@@ -0,0 +1,125 @@
+#include "event.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#define EVENT_BATCH 16
+
+int event_loop_init(event_loop_t *loop) {
+    loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epfd < 0) {
+        perror("epoll_create1");
+        return -1;
+    }
+    return 0;
+}
+
+void event_loop_close(event_loop_t *loop) {
+    if (loop->epfd >= 0)
+        close(loop->epfd);
+    loop->epfd = -1;
+}
+
+static int event_ctl(event_loop_t *loop, int op, event_source_t *src, uint32_t events) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.ptr = src;
+    if (epoll_ctl(loop->epfd, op, src->fd, &ev) < 0) {
+        perror("epoll_ctl");
+        return -1;
+    }
+    return 0;
+}
+
+int event_add(event_loop_t *loop, event_source_t *src, uint32_t events) {
+    return event_ctl(loop, EPOLL_CTL_ADD, src, events);
+}
+
+/* Change the events of interest; 0 pauses a source without removing it */
+int event_modify(event_loop_t *loop, event_source_t *src, uint32_t events) {
+    return event_ctl(loop, EPOLL_CTL_MOD, src, events);
+}
+
+int event_remove(event_loop_t *loop, event_source_t *src) {
+    return event_ctl(loop, EPOLL_CTL_DEL, src, 0);
+}
+
+/* Wait up to timeout_ms (-1: forever) and run the handlers of every ready
+   source.  Returns the number handled, or -1 on error. */
+int event_dispatch(event_loop_t *loop, int timeout_ms) {
+    struct epoll_event ready[EVENT_BATCH];
+    int n = epoll_wait(loop->epfd, ready, EVENT_BATCH, timeout_ms);
+    if (n < 0) {
+        if (errno == EINTR)
+            return 0;
+        perror("epoll_wait");
+        return -1;
+    }
+    for (int i = 0; i < n; i++) {
+        event_source_t *src = ready[i].data.ptr;
+        src->handler(src, ready[i].events);
+    }
+    return n;
+}
+
+int event_timer_open(void) {
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd < 0)
+        perror("timerfd_create");
+    return fd;
+}
+
+/* One-shot timer firing in ms milliseconds; a negative ms disarms it */
+int event_timer_arm(int fd, int ms) {
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    if (ms >= 0) {
+        /* A zero it_value would disarm, so fire "now" as 1 ns */
+        its.it_value.tv_sec = ms / 1000;
+        its.it_value.tv_nsec = (long)(ms % 1000) * 1000000L + (ms == 0);
+    }
+    if (timerfd_settime(fd, 0, &its, NULL) < 0) {
+        perror("timerfd_settime");
+        return -1;
+    }
+    return 0;
+}
+
+/* Consume a timer expiry so the fd stops polling readable */
+void event_timer_ack(int fd) {
+    uint64_t expirations;
+    if (read(fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+        perror("read timerfd");
+}
+
+/* Block the signals in mask and deliver them through a descriptor instead.
+   The previous mask is stored in old_mask for restoring before exec. */
+int event_signal_open(const sigset_t *mask, sigset_t *old_mask) {
+    if (sigprocmask(SIG_BLOCK, mask, old_mask) < 0) {
+        perror("sigprocmask");
+        return -1;
+    }
+    int fd = signalfd(-1, mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (fd < 0)
+        perror("signalfd");
+    return fd;
+}
+
+/* A descriptor that polls readable when pid exits; -1 where the kernel has
+   no pidfd_open (before 5.3), in which case callers fall back to SIGCHLD */
+int event_pidfd_open(pid_t pid) {
+#ifdef SYS_pidfd_open
+    return (int)syscall(SYS_pidfd_open, pid, 0);
+#else
+    (void)pid;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
@@ -1,110 +1,552 @@
 #include "fb.h"
-#include <fcntl.h>
-#include <linux/fb.h>
-#include <sys/ioctl.h>
-#include <sys/mman.h>
-#include <unistd.h>
+#include "fb_backend.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include "font8x8_basic.h"
-
-#ifndef FONT_SCALE
-#define FONT_SCALE 2
-#endif
+#include "fb_blit.h"
+#include "fb_blend.h"
+#include "trace.h"
 
+/* Open a render target.  "mem:WxH[xBPP]" selects the headless in-memory
+   backend; anything else is a framebuffer device path. */
 int fb_init(framebuffer_t *fb, const char *fb_device) {
-    fb->fb_fd = open(fb_device, O_RDWR);
-    if (fb->fb_fd < 0) {
-        perror("open framebuffer");
-        return -1;
+    const fb_backend_t *backend = &fb_backend_fbdev;
+    const char *spec = fb_device;
+    if (strncmp(fb_device, "mem:", 4) == 0) {
+        backend = &fb_backend_memory;
+        spec = fb_device + 4;
     }
-    struct fb_var_screeninfo vinfo;
-    if (ioctl(fb->fb_fd, FBIOGET_VSCREENINFO, &vinfo)) {
-        perror("ioctl FBIOGET_VSCREENINFO");
-        close(fb->fb_fd);
+    fb->backend = backend;
+    fb->shadow = NULL;
+    if (backend->init(fb, spec) < 0)
         return -1;
-    }
-    fb->width = vinfo.xres;
-    fb->height = vinfo.yres;
-    fb->bpp = vinfo.bits_per_pixel;
-    size_t screensize = vinfo.yres_virtual * vinfo.xres_virtual * (vinfo.bits_per_pixel / 8);
-    fb->fb_ptr = (uint8_t *)mmap(NULL, screensize, PROT_READ | PROT_WRITE, MAP_SHARED, fb->fb_fd, 0);
-    if (fb->fb_ptr == MAP_FAILED) {
-        perror("mmap framebuffer");
-        close(fb->fb_fd);
+
+    fb->ops = fb_ops_for_bpp(fb->bpp);
+    fb->font = font_atlas_get(font_scale_for_height(fb->height));
+    if (!fb->ops || !fb->font) {
+        backend->close(fb);
         return -1;
     }
-    fb->fb_size = screensize;
+
+    /* Draw into a system-RAM shadow copy and only push damaged spans to
+       the backend on fb_present().  Without it we fall back to drawing in
+       place on a single page. */
+    fb->shadow = calloc((size_t)fb->width * fb->height, fb->format.bytes_per_pixel);
+    if (fb->shadow) {
+        fb->draw_ptr = fb->shadow;
+        fb->stride = (size_t)fb->width * fb->format.bytes_per_pixel;
+    } else {
+        fb->pages = 1;
+        fb->draw_ptr = fb->vram;
+        fb->stride = fb->vram_stride;
+    }
+    fb->damage_count = 0;
     return 0;
 }
 
+/* Convenience for tools and tests: a headless target of the given size */
+int fb_init_memory(framebuffer_t *fb, int width, int height, int bpp) {
+    char spec[64];
+    snprintf(spec, sizeof(spec), "mem:%dx%dx%d", width, height, bpp);
+    return fb_init(fb, spec);
+}
+
 void fb_close(framebuffer_t *fb) {
-    munmap(fb->fb_ptr, fb->fb_size);
-    close(fb->fb_fd);
+    fb->backend->close(fb);
+    free(fb->shadow);
+    fb->shadow = NULL;
 }
 
-void fb_clear(framebuffer_t *fb, uint32_t color) {
-    if (fb->bpp != 32) {
-        fprintf(stderr, "Only 32 bpp supported in fb_clear\n");
+/* Public: Lend the display to someone else (a session) without unmapping */
+void fb_release(framebuffer_t *fb) {
+    if (fb->backend->release)
+        fb->backend->release(fb);
+}
+
+/* Public: Take the display back after fb_release().  Nothing on screen is
+   kept, so the caller repaints everything.  Returns 0, 1 if the mode
+   changed and the framebuffer has to be closed and initialised again, or
+   -1 on error. */
+int fb_acquire(framebuffer_t *fb) {
+    int ret = fb->backend->acquire ? fb->backend->acquire(fb) : 0;
+    if (ret == 0 && !fb->shadow)
+        fb->draw_ptr = fb->vram;
+    return ret;
+}
+
+/* Copy rectangles of the shadow buffer to a backend surface with its own stride */
+void fb_copy_rects(const framebuffer_t *fb, uint8_t *dst_base, size_t dst_stride,
+                   const fb_rect_t *rects, int count) {
+    int bytespp = fb->format.bytes_per_pixel;
+    for (int i = 0; i < count; i++) {
+        const fb_rect_t *r = &rects[i];
+        const uint8_t *src = fb->shadow + (size_t)r->y * fb->stride + (size_t)r->x * bytespp;
+        uint8_t *dst = dst_base + (size_t)r->y * dst_stride + (size_t)r->x * bytespp;
+        size_t span = (size_t)r->w * bytespp;
+        for (int row = 0; row < r->h; row++) {
+            memcpy(dst, src, span);
+            src += fb->stride;
+            dst += dst_stride;
+        }
+    }
+}
+
+/* Internal: clip a rectangle to the screen; returns 0 if nothing is left */
+static int fb_clip(const framebuffer_t *fb, int *x, int *y, int *w, int *h) {
+    if (*x < 0) { *w += *x; *x = 0; }
+    if (*y < 0) { *h += *y; *y = 0; }
+    if (*x + *w > fb->width) *w = fb->width - *x;
+    if (*y + *h > fb->height) *h = fb->height - *y;
+    return *w > 0 && *h > 0;
+}
+
+static void rect_union(fb_rect_t *a, const fb_rect_t *b) {
+    int x0 = a->x < b->x ? a->x : b->x;
+    int y0 = a->y < b->y ? a->y : b->y;
+    int x1 = (a->x + a->w) > (b->x + b->w) ? (a->x + a->w) : (b->x + b->w);
+    int y1 = (a->y + a->h) > (b->y + b->h) ? (a->y + a->h) : (b->y + b->h);
+    a->x = x0;
+    a->y = y0;
+    a->w = x1 - x0;
+    a->h = y1 - y0;
+}
+
+/* Internal: how many pixels a grows by when it absorbs b */
+static long rect_union_growth(const fb_rect_t *a, const fb_rect_t *b) {
+    fb_rect_t u = *a;
+    rect_union(&u, b);
+    return (long)u.w * u.h - (long)a->w * a->h;
+}
+
+/* Record a dirty rectangle (clipped to the screen) for the next fb_present() */
+void fb_damage(framebuffer_t *fb, int x, int y, int w, int h) {
+    if (!fb_clip(fb, &x, &y, &w, &h))
         return;
+    fb_rect_t r = { x, y, w, h };
+
+    /* Merge only when the union wastes nothing, so e.g. the four edges of
+       an outline stay separate instead of damaging the whole interior. */
+    for (int i = 0; i < fb->damage_count; i++) {
+        if (rect_union_growth(&fb->damage[i], &r) <= (long)w * h) {
+            rect_union(&fb->damage[i], &r);
+            return;
+        }
     }
-    uint32_t *ptr = (uint32_t *)fb->fb_ptr;
-    size_t pixels = fb->width * fb->height;
-    for (size_t i = 0; i < pixels; i++) {
-        ptr[i] = color;
+    if (fb->damage_count < FB_MAX_DAMAGE) {
+        fb->damage[fb->damage_count++] = r;
+        return;
     }
+    /* Out of slots: grow whichever rectangle absorbs this one most cheaply */
+    int best = 0;
+    long best_growth = rect_union_growth(&fb->damage[0], &r);
+    for (int i = 1; i < fb->damage_count; i++) {
+        long growth = rect_union_growth(&fb->damage[i], &r);
+        if (growth < best_growth) {
+            best_growth = growth;
+            best = i;
+        }
+    }
+    rect_union(&fb->damage[best], &r);
+}
+
+/* Push the frame to the display and reset the damage list */
+void fb_present(framebuffer_t *fb) {
+    if (fb->damage_count == 0)
+        return;
+    uint64_t t = trace_begin();
+    fb->backend->present(fb);
+    fb->damage_count = 0;
+    trace_end(TRACE_PRESENT, t);
+    trace_presented();
+}
+
+/* Convert a 0xRRGGBB colour to the framebuffer's native pixel value.  The
+   backends only accept channels 1 to 8 bits wide. */
+uint32_t fb_map_rgb(const framebuffer_t *fb, uint32_t rgb) {
+    const fb_format_t *f = &fb->format;
+    uint32_t r = (rgb >> 16) & 0xFF, g = (rgb >> 8) & 0xFF, b = rgb & 0xFF;
+    return ((r >> (8 - f->red_length)) << f->red_offset) |
+           ((g >> (8 - f->green_length)) << f->green_offset) |
+           ((b >> (8 - f->blue_length)) << f->blue_offset);
+}
+
+/* Internal: Widen a channel of the given bit length to 8 bits */
+static inline uint32_t fb_widen(uint32_t value, int length) {
+    value = (value & ((1u << length) - 1)) << (8 - length);
+    return value | value >> length;
+}
+
+/* Convert a native pixel value back to 0xRRGGBB, replicating the high bits
+   of short channels so white stays white */
+uint32_t fb_unmap_rgb(const framebuffer_t *fb, uint32_t pixel) {
+    const fb_format_t *f = &fb->format;
+    return fb_widen(pixel >> f->red_offset, f->red_length) << 16 |
+           fb_widen(pixel >> f->green_offset, f->green_length) << 8 |
+           fb_widen(pixel >> f->blue_offset, f->blue_length);
+}
+
+/* Internal: address of pixel (x, y) in the draw target */
+static inline uint8_t *fb_pixel_addr(const framebuffer_t *fb, int x, int y) {
+    return fb->draw_ptr + (size_t)y * fb->stride + (size_t)x * fb->format.bytes_per_pixel;
+}
+
+void fb_clear(framebuffer_t *fb, uint32_t color) {
+    fb->ops->fill_rect(fb->draw_ptr, fb->stride, fb->width, fb->height, fb_map_rgb(fb, color));
+    fb_damage(fb, 0, 0, fb->width, fb->height);
 }
 
 void fb_draw_pixel(framebuffer_t *fb, int x, int y, uint32_t color) {
     if (x < 0 || x >= fb->width || y < 0 || y >= fb->height)
         return;
-    if (fb->bpp != 32)
+    fb->ops->fill_span(fb_pixel_addr(fb, x, y), 1, fb_map_rgb(fb, color));
+    fb_damage(fb, x, y, 1, 1);
+}
+
+/* Internal: clipped rectangle fill without damage tracking */
+static void fb_fill(framebuffer_t *fb, int x, int y, int w, int h, uint32_t pixel) {
+    if (!fb_clip(fb, &x, &y, &w, &h))
         return;
-    uint32_t *ptr = (uint32_t *)fb->fb_ptr;
-    ptr[y * fb->width + x] = color;
+    fb->ops->fill_rect(fb_pixel_addr(fb, x, y), fb->stride, w, h, pixel);
 }
 
 void fb_draw_rect(framebuffer_t *fb, int x, int y, int w, int h, uint32_t color) {
-    for (int j = y; j < y + h; j++) {
-        for (int i = x; i < x + w; i++) {
-            fb_draw_pixel(fb, i, j, color);
+    fb_fill(fb, x, y, w, h, fb_map_rgb(fb, color));
+    fb_damage(fb, x, y, w, h);
+}
+
+/* Internal: Are pixels 8888 words in the blend engine's channel order? */
+static int fb_is_argb(const framebuffer_t *fb) {
+    const fb_format_t *f = &fb->format;
+    return fb->bpp == 32 && f->red_offset == 16 && f->green_offset == 8 && f->blue_offset == 0;
+}
+
+/* Internal: Read a native pixel */
+static uint32_t fb_load_pixel(const uint8_t *p, int bytes) {
+    switch (bytes) {
+    case 2: return *(const uint16_t *)p;
+    case 3: return p[0] | p[1] << 8 | p[2] << 16;
+    default: return *(const uint32_t *)p;
+    }
+}
+
+/* Public: Composite n premultiplied 0xAARRGGBB pixels onto the draw target
+   at dst, which the caller has clipped.  One pass of the blend engine on
+   8888 screens; other formats go through 0xRRGGBB and back per pixel. */
+void fb_blend_span(framebuffer_t *fb, uint8_t *dst, const uint32_t *src, int n) {
+    if (fb_is_argb(fb)) {
+        fb_blend_engine()->over((uint32_t *)dst, src, n);
+        return;
+    }
+    int bytes = fb->format.bytes_per_pixel;
+    for (int i = 0; i < n; i++, dst += bytes) {
+        uint32_t s = src[i];
+        if (!s)
+            continue;
+        if (s < 0xFF000000u)
+            s = fb_blend_pixel(fb_unmap_rgb(fb, fb_load_pixel(dst, bytes)), s);
+        fb->ops->fill_span(dst, 1, fb_map_rgb(fb, s & 0xFFFFFF));
+    }
+}
+
+/* Public: Fill a rectangle with a colour at constant opacity (alpha
+   0..255) over what is already there */
+void fb_fill_rect_blend(framebuffer_t *fb, int x, int y, int w, int h, uint32_t color, uint32_t alpha) {
+    if (alpha >= 255) {
+        fb_draw_rect(fb, x, y, w, h, color);
+        return;
+    }
+    if (alpha == 0 || !fb_clip(fb, &x, &y, &w, &h))
+        return;
+    uint32_t src = alpha << 24 | fb_blend_scale(color & 0xFFFFFF, alpha);
+    int bytes = fb->format.bytes_per_pixel;
+    if (fb_is_argb(fb)) {
+        void (*tint)(uint32_t *, uint32_t, size_t) = fb_blend_engine()->tint;
+        for (int row = 0; row < h; row++)
+            tint((uint32_t *)fb_pixel_addr(fb, x, y + row), src, w);
+    } else {
+        for (int row = 0; row < h; row++) {
+            uint8_t *p = fb_pixel_addr(fb, x, y + row);
+            for (int i = 0; i < w; i++, p += bytes) {
+                uint32_t rgb = fb_blend_pixel(fb_unmap_rgb(fb, fb_load_pixel(p, bytes)), src);
+                fb->ops->fill_span(p, 1, fb_map_rgb(fb, rgb & 0xFFFFFF));
+            }
+        }
+    }
+    fb_damage(fb, x, y, w, h);
+}
+
+/* Public: Composite an image of premultiplied 0xAARRGGBB pixels (stride
+   in pixels) with its top left corner at (x, y), its own alpha further
+   scaled by alpha (255: as is) */
+void fb_blit_blend(framebuffer_t *fb, int x, int y, const uint32_t *pixels, int stride,
+                   int w, int h, uint32_t alpha) {
+    int x0 = x, y0 = y;
+    if (alpha == 0 || !fb_clip(fb, &x, &y, &w, &h))
+        return;
+    pixels += (size_t)(y - y0) * stride + (x - x0);
+    void (*scale)(uint32_t *, const uint32_t *, size_t, unsigned) = fb_blend_engine()->scale;
+    for (int row = 0; row < h; row++, pixels += stride) {
+        uint8_t *dst = fb_pixel_addr(fb, x, y + row);
+        if (alpha >= 255) {
+            fb_blend_span(fb, dst, pixels, w);
+            continue;
+        }
+        /* Fade the source a cache-sized chunk at a time */
+        uint32_t faded[256];
+        for (int i = 0; i < w; i += 256) {
+            int n = w - i < 256 ? w - i : 256;
+            scale(faded, pixels + i, n, alpha);
+            fb_blend_span(fb, dst + (size_t)i * fb->format.bytes_per_pixel, faded, n);
         }
     }
+    fb_damage(fb, x, y, w, h);
+}
+
+/* Move a rectangle of the drawing surface dy rows down (up if negative);
+   the vacated rows keep their old contents */
+void fb_scroll_rect(framebuffer_t *fb, int x, int y, int w, int h, int dy) {
+    int dst_y = y + dy;
+    if (!fb_clip(fb, &x, &dst_y, &w, &h))
+        return;
+    int src_y = dst_y - dy;
+    if (src_y < 0 || src_y + h > fb->height)
+        return;
+    size_t bytes = (size_t)w * fb->format.bytes_per_pixel;
+    if (dy > 0) {
+        for (int row = h - 1; row >= 0; row--)
+            memcpy(fb_pixel_addr(fb, x, dst_y + row), fb_pixel_addr(fb, x, src_y + row), bytes);
+    } else if (dy < 0) {
+        for (int row = 0; row < h; row++)
+            memcpy(fb_pixel_addr(fb, x, dst_y + row), fb_pixel_addr(fb, x, src_y + row), bytes);
+    }
+    fb_damage(fb, x, dst_y, w, h);
 }
 
 /* Draw only an outline (transparent box) */
 void fb_draw_rect_outline(framebuffer_t *fb, int x, int y, int w, int h, uint32_t color) {
-    for (int i = x; i < x + w; i++) {
-        fb_draw_pixel(fb, i, y, color);
-        fb_draw_pixel(fb, i, y + h - 1, color);
+    if (w <= 0 || h <= 0)
+        return;
+    uint32_t pixel = fb_map_rgb(fb, color);
+    fb_fill(fb, x, y, w, 1, pixel);
+    fb_fill(fb, x, y + h - 1, w, 1, pixel);
+    fb_fill(fb, x, y, 1, h, pixel);
+    fb_fill(fb, x + w - 1, y, 1, h, pixel);
+    fb_damage(fb, x, y, w, 1);
+    fb_damage(fb, x, y + h - 1, w, 1);
+    fb_damage(fb, x, y, 1, h);
+    fb_damage(fb, x + w - 1, y, 1, h);
+}
+
+/* Internal: draw one atlas glyph as masked row spans, clipping once */
+static void fb_draw_glyph(framebuffer_t *fb, int x, int y, unsigned char c, uint32_t pixel) {
+    const font_atlas_t *font = fb->font;
+    if (c >= FONT_GLYPHS)
+        c = '?';
+    const uint64_t *rows = font_glyph_rows(font, c);
+    int top = font->first_row[c];
+    int bottom = font->last_row[c] + 1;
+    if (y + top < 0)
+        top = -y;
+    if (y + bottom > fb->height)
+        bottom = fb->height - y;
+    if (top >= bottom || x >= fb->width || x + font->cell_w <= 0)
+        return;
+
+    if (x >= 0 && x + font->cell_w <= fb->width) {
+        fb->ops->glyph(fb_pixel_addr(fb, x, y + top), fb->stride, rows + top, bottom - top, pixel);
+        return;
     }
-    for (int j = y; j < y + h; j++) {
-        fb_draw_pixel(fb, x, j, color);
-        fb_draw_pixel(fb, x + w - 1, j, color);
+
+    /* Straddles a vertical edge: trim the masks instead of testing pixels */
+    uint64_t keep = ~0ULL;
+    if (x < 0)
+        keep &= ~0ULL << -x;
+    if (fb->width - x < 64)
+        keep &= (1ULL << (fb->width - x)) - 1;
+    for (int row = top; row < bottom; row++) {
+        uint64_t bits = rows[row] & keep;
+        while (bits) {
+            int start;
+            int len = fb_next_run(&bits, &start);
+            fb->ops->fill_span(fb_pixel_addr(fb, x + start, y + row), len, pixel);
+        }
     }
 }
 
-/* Draw text using an 8x8 bitmap scaled by FONT_SCALE */
+/* Width in pixels of a string in the framebuffer's current font */
+int fb_text_width(const framebuffer_t *fb, const char *text) {
+    return (int)strlen(text) * fb->font->cell_w;
+}
+
+/* Draw text from the pre-scaled glyph atlas */
 void fb_draw_text(framebuffer_t *fb, int x, int y, const char *text, uint32_t color) {
-    while (*text) {
-        unsigned char uc = (unsigned char)*text;
-        if (uc > 127)
-            uc = '?';
-        for (int row = 0; row < 8; row++) {
-            uint8_t row_data = font8x8_basic[(int)uc][row];
-            for (int col = 0; col < 8; col++) {
-                if (row_data & (1 << col)) {
-                    for (int dy = 0; dy < FONT_SCALE; dy++) {
-                        for (int dx = 0; dx < FONT_SCALE; dx++) {
-                            fb_draw_pixel(fb, x + col * FONT_SCALE + dx, y + row * FONT_SCALE + dy, color);
-                        }
-                    }
-                }
+    uint64_t t = trace_begin();
+    uint32_t pixel = fb_map_rgb(fb, color);
+    int start_x = x;
+    for (; *text; text++, x += fb->font->cell_w)
+        fb_draw_glyph(fb, x, y, (unsigned char)*text, pixel);
+    fb_damage(fb, start_x, y, x - start_x, fb->font->cell_h);
+    trace_end(TRACE_TEXT, t);
+}
+
+/* Internal: fill the set bits of a row mask whose bit 0 lies at x */
+static void fb_draw_mask_row(framebuffer_t *fb, int x, int y, uint64_t bits, uint32_t pixel) {
+    if (y < 0 || y >= fb->height || x >= fb->width || x <= -64)
+        return;
+    if (x < 0)
+        bits &= ~0ULL << -x;
+    if (fb->width - x < 64)
+        bits &= (1ULL << (fb->width - x)) - 1;
+    while (bits) {
+        int start;
+        int len = fb_next_run(&bits, &start);
+        fb->ops->fill_span(fb_pixel_addr(fb, x + start, y), len, pixel);
+    }
+}
+
+/* Draw text with an outline of the given radius in one pass: every row of
+   every glyph emits its outline spans and fill spans together.  Outline
+   bits covering a neighbouring glyph's fill are masked out, which is what
+   drawing all outlines first and all fills second would give. */
+void fb_draw_text_outlined(framebuffer_t *fb, int x, int y, const char *text,
+                           uint32_t color, uint32_t outline_color, int radius) {
+    const font_atlas_t *font = fb->font;
+    const font_outline_t *outline = font_outline_get(font, radius);
+    if (!outline) {
+        fb_draw_text(fb, x, y, text, color);
+        return;
+    }
+    uint64_t t = trace_begin();
+    radius = outline->radius;
+    uint32_t pixel = fb_map_rgb(fb, color);
+    uint32_t outline_pixel = fb_map_rgb(fb, outline_color);
+    int cell = font->cell_w;
+    int start_x = x;
+    unsigned char prev = ' ';
+
+    for (; *text; text++, x += cell) {
+        unsigned char c = (unsigned char)*text;
+        unsigned char next = (unsigned char)text[1];
+        const uint64_t *fill = font_glyph_rows(font, c);
+        const uint64_t *prev_fill = font_glyph_rows(font, prev);
+        const uint64_t *next_fill = font_glyph_rows(font, next ? next : ' ');
+        const uint64_t *dilated = font_outline_rows(outline, c);
+        int ox = x - radius;
+        for (int row = 0; row < outline->cell_h; row++) {
+            uint64_t bits = dilated[row];
+            if (!bits)
+                continue;
+            int src = row - radius;
+            uint64_t ink = 0;
+            if (src >= 0 && src < font->cell_h) {
+                ink = fill[src] << radius;
+                bits &= ~ink;
+                bits &= ~((prev_fill[src] << radius) >> cell);
+                bits &= ~((next_fill[src] << radius) << cell);
             }
+            int py = y - radius + row;
+            fb_draw_mask_row(fb, ox, py, bits, outline_pixel);
+            fb_draw_mask_row(fb, ox, py, ink, pixel);
+        }
+        prev = c;
+    }
+    fb_damage(fb, start_x - radius, y - radius, x - start_x + 2 * radius, font->cell_h + 2 * radius);
+    trace_end(TRACE_TEXT, t);
+}
+
+/* Size a layer to match the screen, keeping its buffer if it already does.
+   The contents are undefined until drawn through a view or captured; -1 on
+   allocation failure */
+int fb_layer_alloc(const framebuffer_t *fb, fb_layer_t *layer) {
+    size_t stride = (size_t)fb->width * fb->format.bytes_per_pixel;
+    if (!layer->pixels || layer->width != fb->width || layer->height != fb->height) {
+        uint8_t *pixels = realloc(layer->pixels, stride * fb->height);
+        if (!pixels) {
+            perror("realloc layer");
+            return -1;
         }
-        x += 8 * FONT_SCALE;
-        text++;
+        layer->pixels = pixels;
+        layer->width = fb->width;
+        layer->height = fb->height;
+        layer->stride = stride;
+    }
+    return 0;
+}
+
+/* Snapshot the current drawing surface into a layer, (re)allocating it to
+   match the screen; -1 on allocation failure */
+int fb_layer_capture(framebuffer_t *fb, fb_layer_t *layer) {
+    if (fb_layer_alloc(fb, layer) < 0)
+        return -1;
+    size_t stride = layer->stride;
+    for (int row = 0; row < fb->height; row++)
+        memcpy(layer->pixels + row * layer->stride, fb->draw_ptr + row * fb->stride, stride);
+    return 0;
+}
+
+/* Copy a rectangle of a layer back onto the drawing surface */
+void fb_layer_restore(framebuffer_t *fb, const fb_layer_t *layer, int x, int y, int w, int h) {
+    if (layer->width != fb->width || layer->height != fb->height)
+        return;
+    if (!fb_clip(fb, &x, &y, &w, &h))
+        return;
+    int bytespp = fb->format.bytes_per_pixel;
+    const uint8_t *src = layer->pixels + (size_t)y * layer->stride + (size_t)x * bytespp;
+    uint8_t *dst = fb_pixel_addr(fb, x, y);
+    for (int row = 0; row < h; row++) {
+        memcpy(dst, src, (size_t)w * bytespp);
+        src += layer->stride;
+        dst += fb->stride;
     }
+    fb_damage(fb, x, y, w, h);
 }
 
+/* Set up a framebuffer_t that draws into a layer, so the usual primitives
+   can render off-screen.  Damage is recorded on the view, which must never
+   be presented or closed. */
+void fb_layer_view(const framebuffer_t *fb, fb_layer_t *layer, framebuffer_t *view) {
+    *view = *fb;
+    view->draw_ptr = layer->pixels;
+    view->stride = layer->stride;
+    view->damage_count = 0;
+}
+
+void fb_layer_free(fb_layer_t *layer) {
+    free(layer->pixels);
+    layer->pixels = NULL;
+    layer->width = layer->height = 0;
+}
+
+/* Write the visible frame of a framebuffer as a binary PPM */
+int fb_dump_ppm(const framebuffer_t *fb, const char *path) {
+    FILE *fp = fopen(path, "wb");
+    if (!fp) {
+        perror("fopen ppm");
+        return -1;
+    }
+    int bytes = fb->format.bytes_per_pixel;
+    uint8_t *row = malloc((size_t)fb->width * 3);
+    if (!row) {
+        fclose(fp);
+        return -1;
+    }
+    int ok = fprintf(fp, "P6\n%d %d\n255\n", fb->width, fb->height) > 0;
+    for (int y = 0; y < fb->height && ok; y++) {
+        const uint8_t *src = fb->vram + (size_t)y * fb->vram_stride;
+        for (int x = 0; x < fb->width; x++, src += bytes) {
+            uint32_t px = 0;
+            memcpy(&px, src, bytes);
+            uint32_t rgb = fb_unmap_rgb(fb, px);
+            row[x * 3 + 0] = rgb >> 16;
+            row[x * 3 + 1] = rgb >> 8;
+            row[x * 3 + 2] = rgb;
+        }
+        ok = fwrite(row, 3, fb->width, fp) == (size_t)fb->width;
+    }
+    free(row);
+    if (fclose(fp) != 0 || !ok) {
+        perror(path);
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,241 @@
+#include "fb_blend.h"
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FB_BLEND_X86 1
+#endif
+
+/* Sprites are mostly runs of opaque pixels with a soft edge, so every
+   kernel stores opaque pixels straight and leaves fully transparent ones
+   (all zero when premultiplied) alone before doing any arithmetic. */
+static void over_scalar(uint32_t *dst, const uint32_t *src, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        uint32_t s = src[i];
+        if (s >= 0xFF000000u)
+            dst[i] = s;
+        else if (s)
+            dst[i] = fb_blend_pixel(dst[i], s);
+    }
+}
+
+static void tint_scalar(uint32_t *dst, uint32_t src, size_t n) {
+    uint32_t inv = 255 - (src >> 24);
+    for (size_t i = 0; i < n; i++)
+        dst[i] = src + fb_blend_scale(dst[i], inv);
+}
+
+static void scale_scalar(uint32_t *dst, const uint32_t *src, size_t n, unsigned a) {
+    for (size_t i = 0; i < n; i++)
+        dst[i] = fb_blend_scale(src[i], a);
+}
+
+static void lerp_scalar(uint32_t *dst, const uint32_t *a, const uint32_t *b, size_t n, unsigned w) {
+    for (size_t i = 0; i < n; i++)
+        dst[i] = fb_blend_lerp(a[i], b[i], w);
+}
+
+#ifdef FB_BLEND_X86
+/* SSE2: four pixels at a time, widened to 16-bit lanes.  Each pixel's
+   alpha is broadcast across its four lanes with a pair of shuffles, and
+   t / 255 is computed as (t + (t >> 8)) >> 8 after adding 128. */
+__attribute__((target("sse2")))
+static inline __m128i scale_by_alpha_sse2(__m128i d, __m128i s) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ff = _mm_set1_epi16(255), half = _mm_set1_epi16(128);
+    __m128i sl = _mm_unpacklo_epi8(s, zero), sh = _mm_unpackhi_epi8(s, zero);
+    __m128i il = _mm_sub_epi16(ff, _mm_shufflehi_epi16(_mm_shufflelo_epi16(sl, 0xFF), 0xFF));
+    __m128i ih = _mm_sub_epi16(ff, _mm_shufflehi_epi16(_mm_shufflelo_epi16(sh, 0xFF), 0xFF));
+    __m128i tl = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), il), half);
+    __m128i th = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), ih), half);
+    tl = _mm_srli_epi16(_mm_add_epi16(tl, _mm_srli_epi16(tl, 8)), 8);
+    th = _mm_srli_epi16(_mm_add_epi16(th, _mm_srli_epi16(th, 8)), 8);
+    return _mm_packus_epi16(tl, th);
+}
+
+__attribute__((target("sse2")))
+static void over_sse2(uint32_t *dst, const uint32_t *src, size_t n) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i amask = _mm_set1_epi32((int)0xFF000000u);
+    for (; n >= 4; n -= 4, dst += 4, src += 4) {
+        __m128i s = _mm_loadu_si128((const __m128i *)src);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(s, amask), amask)) == 0xFFFF) {
+            _mm_storeu_si128((__m128i *)dst, s);
+            continue;
+        }
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(s, zero)) == 0xFFFF)
+            continue;
+        __m128i d = _mm_loadu_si128((const __m128i *)dst);
+        _mm_storeu_si128((__m128i *)dst, _mm_adds_epu8(s, scale_by_alpha_sse2(d, s)));
+    }
+    over_scalar(dst, src, n);
+}
+
+/* The same rounding with one factor (in every 16-bit lane of f) for all
+   pixels */
+__attribute__((target("sse2")))
+static inline __m128i mul_sse2(__m128i d, __m128i f) {
+    const __m128i zero = _mm_setzero_si128(), half = _mm_set1_epi16(128);
+    __m128i tl = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), f), half);
+    __m128i th = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), f), half);
+    tl = _mm_srli_epi16(_mm_add_epi16(tl, _mm_srli_epi16(tl, 8)), 8);
+    th = _mm_srli_epi16(_mm_add_epi16(th, _mm_srli_epi16(th, 8)), 8);
+    return _mm_packus_epi16(tl, th);
+}
+
+__attribute__((target("sse2")))
+static void tint_sse2(uint32_t *dst, uint32_t src, size_t n) {
+    const __m128i s = _mm_set1_epi32((int)src), inv = _mm_set1_epi16((short)(255 - (src >> 24)));
+    for (; n >= 4; n -= 4, dst += 4) {
+        __m128i d = _mm_loadu_si128((const __m128i *)dst);
+        _mm_storeu_si128((__m128i *)dst, _mm_adds_epu8(s, mul_sse2(d, inv)));
+    }
+    tint_scalar(dst, src, n);
+}
+
+__attribute__((target("sse2")))
+static void scale_sse2(uint32_t *dst, const uint32_t *src, size_t n, unsigned a) {
+    const __m128i f = _mm_set1_epi16((short)a);
+    for (; n >= 4; n -= 4, dst += 4, src += 4)
+        _mm_storeu_si128((__m128i *)dst, mul_sse2(_mm_loadu_si128((const __m128i *)src), f));
+    scale_scalar(dst, src, n, a);
+}
+
+/* Row mixing in 16-bit lanes: a * (128 - w) + b * w stays below 2^15 */
+__attribute__((target("sse2")))
+static void lerp_sse2(uint32_t *dst, const uint32_t *a, const uint32_t *b, size_t n, unsigned w) {
+    const __m128i zero = _mm_setzero_si128(), round = _mm_set1_epi16(64);
+    const __m128i wa = _mm_set1_epi16((short)(128 - w)), wb = _mm_set1_epi16((short)w);
+    for (; n >= 4; n -= 4, dst += 4, a += 4, b += 4) {
+        __m128i va = _mm_loadu_si128((const __m128i *)a), vb = _mm_loadu_si128((const __m128i *)b);
+        __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(va, zero), wa),
+                                   _mm_mullo_epi16(_mm_unpacklo_epi8(vb, zero), wb));
+        __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(va, zero), wa),
+                                   _mm_mullo_epi16(_mm_unpackhi_epi8(vb, zero), wb));
+        lo = _mm_srli_epi16(_mm_add_epi16(lo, round), 7);
+        hi = _mm_srli_epi16(_mm_add_epi16(hi, round), 7);
+        _mm_storeu_si128((__m128i *)dst, _mm_packus_epi16(lo, hi));
+    }
+    lerp_scalar(dst, a, b, n, w);
+}
+
+/* AVX2: the same with eight pixels; unpack, shuffle and pack all work
+   within 128-bit lanes, so pixel order is preserved */
+__attribute__((target("avx2")))
+static void over_avx2(uint32_t *dst, const uint32_t *src, size_t n) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i ff = _mm256_set1_epi16(255), half = _mm256_set1_epi16(128);
+    const __m256i amask = _mm256_set1_epi32((int)0xFF000000u);
+    for (; n >= 8; n -= 8, dst += 8, src += 8) {
+        __m256i s = _mm256_loadu_si256((const __m256i *)src);
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(_mm256_and_si256(s, amask), amask)) == -1) {
+            _mm256_storeu_si256((__m256i *)dst, s);
+            continue;
+        }
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(s, zero)) == -1)
+            continue;
+        __m256i d = _mm256_loadu_si256((const __m256i *)dst);
+        __m256i sl = _mm256_unpacklo_epi8(s, zero), sh = _mm256_unpackhi_epi8(s, zero);
+        __m256i il = _mm256_sub_epi16(ff, _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(sl, 0xFF), 0xFF));
+        __m256i ih = _mm256_sub_epi16(ff, _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(sh, 0xFF), 0xFF));
+        __m256i tl = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(d, zero), il), half);
+        __m256i th = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(d, zero), ih), half);
+        tl = _mm256_srli_epi16(_mm256_add_epi16(tl, _mm256_srli_epi16(tl, 8)), 8);
+        th = _mm256_srli_epi16(_mm256_add_epi16(th, _mm256_srli_epi16(th, 8)), 8);
+        _mm256_storeu_si256((__m256i *)dst, _mm256_adds_epu8(s, _mm256_packus_epi16(tl, th)));
+    }
+    over_scalar(dst, src, n);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i mul_avx2(__m256i d, __m256i f) {
+    const __m256i zero = _mm256_setzero_si256(), half = _mm256_set1_epi16(128);
+    __m256i tl = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(d, zero), f), half);
+    __m256i th = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(d, zero), f), half);
+    tl = _mm256_srli_epi16(_mm256_add_epi16(tl, _mm256_srli_epi16(tl, 8)), 8);
+    th = _mm256_srli_epi16(_mm256_add_epi16(th, _mm256_srli_epi16(th, 8)), 8);
+    return _mm256_packus_epi16(tl, th);
+}
+
+__attribute__((target("avx2")))
+static void tint_avx2(uint32_t *dst, uint32_t src, size_t n) {
+    const __m256i s = _mm256_set1_epi32((int)src);
+    const __m256i inv = _mm256_set1_epi16((short)(255 - (src >> 24)));
+    for (; n >= 8; n -= 8, dst += 8) {
+        __m256i d = _mm256_loadu_si256((const __m256i *)dst);
+        _mm256_storeu_si256((__m256i *)dst, _mm256_adds_epu8(s, mul_avx2(d, inv)));
+    }
+    tint_scalar(dst, src, n);
+}
+
+__attribute__((target("avx2")))
+static void scale_avx2(uint32_t *dst, const uint32_t *src, size_t n, unsigned a) {
+    const __m256i f = _mm256_set1_epi16((short)a);
+    for (; n >= 8; n -= 8, dst += 8, src += 8)
+        _mm256_storeu_si256((__m256i *)dst, mul_avx2(_mm256_loadu_si256((const __m256i *)src), f));
+    scale_scalar(dst, src, n, a);
+}
+
+__attribute__((target("avx2")))
+static void lerp_avx2(uint32_t *dst, const uint32_t *a, const uint32_t *b, size_t n, unsigned w) {
+    const __m256i zero = _mm256_setzero_si256(), round = _mm256_set1_epi16(64);
+    const __m256i wa = _mm256_set1_epi16((short)(128 - w)), wb = _mm256_set1_epi16((short)w);
+    for (; n >= 8; n -= 8, dst += 8, a += 8, b += 8) {
+        __m256i va = _mm256_loadu_si256((const __m256i *)a), vb = _mm256_loadu_si256((const __m256i *)b);
+        __m256i lo = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(va, zero), wa),
+                                      _mm256_mullo_epi16(_mm256_unpacklo_epi8(vb, zero), wb));
+        __m256i hi = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(va, zero), wa),
+                                      _mm256_mullo_epi16(_mm256_unpackhi_epi8(vb, zero), wb));
+        lo = _mm256_srli_epi16(_mm256_add_epi16(lo, round), 7);
+        hi = _mm256_srli_epi16(_mm256_add_epi16(hi, round), 7);
+        _mm256_storeu_si256((__m256i *)dst, _mm256_packus_epi16(lo, hi));
+    }
+    lerp_scalar(dst, a, b, n, w);
+}
+#endif
+
+static const fb_blend_engine_t engines[] = {
+#ifdef FB_BLEND_X86
+    { "avx2", over_avx2, tint_avx2, scale_avx2, lerp_avx2 },
+    { "sse2", over_sse2, tint_sse2, scale_sse2, lerp_sse2 },
+#endif
+    { "scalar", over_scalar, tint_scalar, scale_scalar, lerp_scalar },
+};
+
+static const fb_blend_engine_t *active_engine;
+
+/* Internal: whether the running CPU can execute an engine's kernels */
+static int engine_supported(const fb_blend_engine_t *e) {
+#ifdef FB_BLEND_X86
+    __builtin_cpu_init();
+    if (strcmp(e->name, "avx2") == 0)
+        return __builtin_cpu_supports("avx2");
+    if (strcmp(e->name, "sse2") == 0)
+        return __builtin_cpu_supports("sse2");
+#endif
+    return strcmp(e->name, "scalar") == 0;
+}
+
+/* Return the fastest supported engine, selecting it on first use */
+const fb_blend_engine_t *fb_blend_engine(void) {
+    if (!active_engine) {
+        for (size_t i = 0; i < sizeof(engines) / sizeof(engines[0]); i++) {
+            if (engine_supported(&engines[i])) {
+                active_engine = &engines[i];
+                break;
+            }
+        }
+    }
+    return active_engine;
+}
+
+/* Force a specific engine by name (for benchmarking); -1 if unavailable */
+int fb_blend_select(const char *name) {
+    for (size_t i = 0; i < sizeof(engines) / sizeof(engines[0]); i++) {
+        if (strcmp(engines[i].name, name) == 0 && engine_supported(&engines[i])) {
+            active_engine = &engines[i];
+            return 0;
+        }
+    }
+    return -1;
+}
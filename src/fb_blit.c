@@ -0,0 +1,54 @@
+#include "fb_blit.h"
+#include "fb_fill.h"
+
+#define STORE16(p, px) (*(uint16_t *)(p) = (uint16_t)(px))
+#define STORE24(p, px) ((p)[0] = (uint8_t)(px), (p)[1] = (uint8_t)((px) >> 8), (p)[2] = (uint8_t)((px) >> 16))
+#define STORE32(p, px) (*(uint32_t *)(p) = (px))
+
+/* Generate scalar span and glyph kernels for one pixel size.  Each atlas
+   row is a coverage mask whose runs of set bits become single span fills.
+   Runs are short, so they stay scalar even where large fills use the SIMD
+   engine. */
+#define FB_DEFINE_KERNELS(NAME, BYTES, STORE)                                        \
+static void fill_span_##NAME(uint8_t *dst, int n, uint32_t pixel) {                 \
+    for (int i = 0; i < n; i++, dst += BYTES)                                        \
+        STORE(dst, pixel);                                                           \
+}                                                                                    \
+                                                                                     \
+static void glyph_##NAME(uint8_t *dst, size_t stride, const uint64_t *rows,         \
+                         int nrows, uint32_t pixel) {                                \
+    for (int row = 0; row < nrows; row++, dst += stride) {                           \
+        uint64_t bits = rows[row];                                                   \
+        while (bits) {                                                               \
+            int start;                                                               \
+            int len = fb_next_run(&bits, &start);                                    \
+            fill_span_##NAME(dst + (size_t)start * BYTES, len, pixel);               \
+        }                                                                            \
+    }                                                                                \
+}
+
+FB_DEFINE_KERNELS(16, 2, STORE16)
+FB_DEFINE_KERNELS(24, 3, STORE24)
+FB_DEFINE_KERNELS(32, 4, STORE32)
+
+static void fill_rect_24(uint8_t *dst, size_t stride, int w, int h, uint32_t pixel) {
+    for (int j = 0; j < h; j++, dst += stride)
+        fill_span_24(dst, w, pixel);
+}
+
+/* 16 and 32 bpp spans and rectangles go through the SIMD fill engine; 24 bpp
+   has a 3-byte period that does not map onto vector lanes and stays scalar. */
+static const fb_ops_t ops_16 = { 2, fb_fill_span16, fb_fill_rect16, glyph_16 };
+static const fb_ops_t ops_24 = { 3, fill_span_24, fill_rect_24, glyph_24 };
+static const fb_ops_t ops_32 = { 4, fb_fill_span32, fb_fill_rect32, glyph_32 };
+
+/* Pick the kernel set for a framebuffer depth, or NULL if unsupported */
+const fb_ops_t *fb_ops_for_bpp(int bits_per_pixel) {
+    switch (bits_per_pixel) {
+        case 16: return &ops_16;
+        case 24: return &ops_24;
+        case 32: return &ops_32;
+        default: return NULL;
+    }
+}
+
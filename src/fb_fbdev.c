@@ -0,0 +1,239 @@
+#include "fb_backend.h"
+#include "fb_blit.h"
+#include "trace.h"
+#include <fcntl.h>
+#include <linux/fb.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+
+/* fbdev backend: draws to /dev/fbN through an mmap'd mapping, flipping
+   between two pages when the driver allows it. */
+
+/* Internal: try to get a second page below the visible one for page
+   flipping, growing yres_virtual if the driver allows it.  Updates vinfo
+   and finfo in place; returns 2 on success, 1 if only one page is usable. */
+static int fb_setup_pages(framebuffer_t *fb, struct fb_var_screeninfo *vinfo,
+                          struct fb_fix_screeninfo *finfo) {
+    if (finfo->ypanstep == 0)
+        return 1;
+    if (vinfo->yres_virtual < 2 * vinfo->yres) {
+        struct fb_var_screeninfo want = *vinfo;
+        want.yres_virtual = 2 * vinfo->yres;
+        want.yoffset = 0;
+        if (ioctl(fb->fb_fd, FBIOPUT_VSCREENINFO, &want) < 0 ||
+            ioctl(fb->fb_fd, FBIOGET_VSCREENINFO, &want) < 0 ||
+            want.yres_virtual < 2 * vinfo->yres || want.xres != vinfo->xres ||
+            want.bits_per_pixel != vinfo->bits_per_pixel) {
+            ioctl(fb->fb_fd, FBIOPUT_VSCREENINFO, &fb->orig_vinfo);
+            return 1;
+        }
+        fb->vinfo_changed = 1;
+        *vinfo = want;
+        if (ioctl(fb->fb_fd, FBIOGET_FSCREENINFO, finfo) < 0)
+            return 1;
+    }
+    size_t line = finfo->line_length ? finfo->line_length
+                                     : (size_t)vinfo->xres_virtual * (vinfo->bits_per_pixel / 8);
+    if ((size_t)finfo->smem_len < 2 * (size_t)vinfo->yres * line)
+        return 1;
+    return 2;
+}
+
+/* Internal: Start scanning out with the page setup in fb->pages and
+   vinfo: page 0 is shown first when flipping, so drawing goes to page 1 */
+static void fbdev_show(framebuffer_t *fb, struct fb_var_screeninfo *vinfo) {
+    if (fb->pages == 2) {
+        vinfo->yoffset = 0;
+        if (ioctl(fb->fb_fd, FBIOPAN_DISPLAY, vinfo) < 0)
+            fb->pages = 1;
+    }
+    fb->vinfo = *vinfo;
+    fb->front = 0;
+    fb->vram = fb->fb_ptr + (size_t)vinfo->yoffset * fb->vram_stride +
+               (size_t)vinfo->xoffset * fb->format.bytes_per_pixel;
+    fb->prev_damage_count = 0;
+}
+
+/* Internal: Can fb_map_rgb() and fb_unmap_rgb() convert this channel to
+   and from 8 bits? */
+static int fbdev_channel_ok(const struct fb_bitfield *c) {
+    return c->length >= 1 && c->length <= 8;
+}
+
+static int fbdev_init(framebuffer_t *fb, const char *fb_device) {
+    fb->fb_fd = open(fb_device, O_RDWR | O_CLOEXEC);
+    if (fb->fb_fd < 0) {
+        perror("open framebuffer");
+        return -1;
+    }
+    struct fb_var_screeninfo vinfo;
+    if (ioctl(fb->fb_fd, FBIOGET_VSCREENINFO, &vinfo)) {
+        perror("ioctl FBIOGET_VSCREENINFO");
+        close(fb->fb_fd);
+        return -1;
+    }
+    struct fb_fix_screeninfo finfo;
+    if (ioctl(fb->fb_fd, FBIOGET_FSCREENINFO, &finfo)) {
+        perror("ioctl FBIOGET_FSCREENINFO");
+        close(fb->fb_fd);
+        return -1;
+    }
+    if (!fb_ops_for_bpp(vinfo.bits_per_pixel)) {
+        fprintf(stderr, "Unsupported framebuffer depth: %u bpp\n", vinfo.bits_per_pixel);
+        close(fb->fb_fd);
+        return -1;
+    }
+    if (!fbdev_channel_ok(&vinfo.red) || !fbdev_channel_ok(&vinfo.green) ||
+        !fbdev_channel_ok(&vinfo.blue)) {
+        fprintf(stderr, "Unsupported framebuffer format: %u/%u/%u bit channels\n",
+                vinfo.red.length, vinfo.green.length, vinfo.blue.length);
+        close(fb->fb_fd);
+        return -1;
+    }
+    fb->orig_vinfo = vinfo;
+    fb->vinfo_changed = 0;
+    fb->pages = fb_setup_pages(fb, &vinfo, &finfo);
+    fb->front = 0;
+
+    fb->width = vinfo.xres;
+    fb->height = vinfo.yres;
+    fb->bpp = vinfo.bits_per_pixel;
+    fb->format.bytes_per_pixel = vinfo.bits_per_pixel / 8;
+    fb->format.red_offset = vinfo.red.offset;
+    fb->format.red_length = vinfo.red.length;
+    fb->format.green_offset = vinfo.green.offset;
+    fb->format.green_length = vinfo.green.length;
+    fb->format.blue_offset = vinfo.blue.offset;
+    fb->format.blue_length = vinfo.blue.length;
+
+    /* Rows may be padded beyond xres; some drivers leave line_length unset */
+    fb->vram_stride = finfo.line_length;
+    if (fb->vram_stride == 0)
+        fb->vram_stride = (size_t)vinfo.xres_virtual * fb->format.bytes_per_pixel;
+    size_t screensize = vinfo.yres_virtual * fb->vram_stride;
+    fb->fb_ptr = (uint8_t *)mmap(NULL, screensize, PROT_READ | PROT_WRITE, MAP_SHARED, fb->fb_fd, 0);
+    if (fb->fb_ptr == MAP_FAILED) {
+        perror("mmap framebuffer");
+        if (fb->vinfo_changed)
+            ioctl(fb->fb_fd, FBIOPUT_VSCREENINFO, &fb->orig_vinfo);
+        close(fb->fb_fd);
+        return -1;
+    }
+    fb->fb_size = screensize;
+    fbdev_show(fb, &vinfo);
+    fb->vsync = fb->pages == 2;
+    return 0;
+}
+
+/* Internal: start of page n (0 or 1) in the mapping */
+static uint8_t *fb_page_ptr(const framebuffer_t *fb, int page) {
+    return fb->fb_ptr + (size_t)page * fb->height * fb->vram_stride +
+           (size_t)fb->vinfo.xoffset * fb->format.bytes_per_pixel;
+}
+
+/* Hand the display back to the console: the last frame goes to the page it
+   scans out and its original mode (virtual height, pan) is restored */
+static void fbdev_release(framebuffer_t *fb) {
+    if (fb->pages == 2 && fb->shadow) {
+        /* Leave the final frame on the page the console expects to scan out */
+        fb_rect_t all = { 0, 0, fb->width, fb->height };
+        uint8_t *visible = fb->fb_ptr + (size_t)fb->orig_vinfo.yoffset * fb->vram_stride +
+                           (size_t)fb->orig_vinfo.xoffset * fb->format.bytes_per_pixel;
+        if (fb->orig_vinfo.yoffset + fb->height <= fb->vinfo.yres_virtual)
+            fb_copy_rects(fb, visible, fb->vram_stride, &all, 1);
+        if (fb->vinfo_changed)
+            ioctl(fb->fb_fd, FBIOPUT_VSCREENINFO, &fb->orig_vinfo);
+        else
+            ioctl(fb->fb_fd, FBIOPAN_DISPLAY, &fb->orig_vinfo);
+    } else if (fb->vinfo_changed) {
+        ioctl(fb->fb_fd, FBIOPUT_VSCREENINFO, &fb->orig_vinfo);
+    }
+}
+
+/* Take the display back after a release.  The mode may have been changed
+   meanwhile (fbset, a console font or resolution switch); the mapping is
+   kept only while geometry and pixel format still match it.  Returns 0,
+   1 if the framebuffer has to be reopened, or -1 on error. */
+static int fbdev_acquire(framebuffer_t *fb) {
+    struct fb_var_screeninfo vinfo;
+    struct fb_fix_screeninfo finfo;
+    if (ioctl(fb->fb_fd, FBIOGET_VSCREENINFO, &vinfo) < 0 ||
+        ioctl(fb->fb_fd, FBIOGET_FSCREENINFO, &finfo) < 0) {
+        perror("ioctl FBIOGET_SCREENINFO");
+        return -1;
+    }
+    size_t stride = finfo.line_length ? finfo.line_length
+                                      : (size_t)vinfo.xres_virtual * (vinfo.bits_per_pixel / 8);
+    if ((int)vinfo.xres != fb->width || (int)vinfo.yres != fb->height ||
+        (int)vinfo.bits_per_pixel != fb->bpp || stride != fb->vram_stride ||
+        vinfo.red.offset != fb->format.red_offset || vinfo.green.offset != fb->format.green_offset ||
+        vinfo.blue.offset != fb->format.blue_offset || vinfo.red.length != fb->format.red_length ||
+        vinfo.green.length != fb->format.green_length || vinfo.blue.length != fb->format.blue_length)
+        return 1;
+    fb->orig_vinfo = vinfo;
+    fb->vinfo_changed = 0;
+    fb->pages = fb_setup_pages(fb, &vinfo, &finfo);
+    size_t rows = fb->pages == 2 ? 2 * (size_t)fb->height : vinfo.yoffset + (size_t)fb->height;
+    if (rows * fb->vram_stride > fb->fb_size) {
+        if (fb->vinfo_changed)
+            ioctl(fb->fb_fd, FBIOPUT_VSCREENINFO, &fb->orig_vinfo);
+        return 1;
+    }
+    fbdev_show(fb, &vinfo);
+    return 0;
+}
+
+static void fbdev_close(framebuffer_t *fb) {
+    fbdev_release(fb);
+    munmap(fb->fb_ptr, fb->fb_size);
+    close(fb->fb_fd);
+}
+
+/* With two pages, the damaged spans (plus last frame's, which the back page
+   has not seen yet) are copied into the back page, which is then flipped in
+   with FBIOPAN_DISPLAY, optionally after waiting for vblank.  With one page
+   the damaged spans are blitted straight to the visible area. */
+static void fbdev_present(framebuffer_t *fb) {
+    if (fb->pages == 2 && fb->shadow) {
+        int back = !fb->front;
+        uint8_t *page = fb_page_ptr(fb, back);
+        fb_copy_rects(fb, page, fb->vram_stride, fb->prev_damage, fb->prev_damage_count);
+        fb_copy_rects(fb, page, fb->vram_stride, fb->damage, fb->damage_count);
+        fb->vinfo.yoffset = back * fb->height;
+        uint64_t t = trace_begin();
+        if (fb->vsync) {
+            uint32_t crtc = 0;
+            if (ioctl(fb->fb_fd, FBIO_WAITFORVSYNC, &crtc) < 0)
+                fb->vsync = 0;
+        }
+        int flipped = ioctl(fb->fb_fd, FBIOPAN_DISPLAY, &fb->vinfo) == 0;
+        trace_end(TRACE_FLIP, t);
+        if (flipped) {
+            fb->front = back;
+            fb->vram = page;
+        } else {
+            /* Driver refused the flip: keep showing this page from now on */
+            fb->vinfo.yoffset = fb->front * fb->height;
+            fb->pages = 1;
+            fb->vram = fb_page_ptr(fb, fb->front);
+            fb_rect_t all = { 0, 0, fb->width, fb->height };
+            fb_copy_rects(fb, fb->vram, fb->vram_stride, &all, 1);
+        }
+        memcpy(fb->prev_damage, fb->damage, sizeof(fb->damage));
+        fb->prev_damage_count = fb->damage_count;
+    } else {
+        if (fb->shadow)
+            fb_copy_rects(fb, fb->vram, fb->vram_stride, fb->damage, fb->damage_count);
+        /* Some drivers only refresh the scanout on a pan request */
+        uint64_t t = trace_begin();
+        ioctl(fb->fb_fd, FBIOPAN_DISPLAY, &fb->vinfo);
+        trace_end(TRACE_FLIP, t);
+    }
+}
+
+const fb_backend_t fb_backend_fbdev = {
+    "fbdev", fbdev_init, fbdev_present, fbdev_close, fbdev_release, fbdev_acquire
+};
@@ -0,0 +1,182 @@
+#include "fb_fill.h"
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FB_FILL_X86 1
+#endif
+
+static void span_scalar(uint32_t *dst, size_t n, uint32_t value) {
+    for (size_t i = 0; i < n; i++)
+        dst[i] = value;
+}
+
+#ifdef FB_FILL_X86
+/* SSE2: align to 16 bytes with scalar stores, then 64 bytes per iteration */
+__attribute__((target("sse2")))
+static inline void span_sse2_common(uint32_t *dst, size_t n, uint32_t value, int nt) {
+    while (n && ((uintptr_t)dst & 15)) {
+        *dst++ = value;
+        n--;
+    }
+    __m128i v = _mm_set1_epi32((int)value);
+    if (nt) {
+        for (; n >= 16; n -= 16, dst += 16) {
+            _mm_stream_si128((__m128i *)dst, v);
+            _mm_stream_si128((__m128i *)dst + 1, v);
+            _mm_stream_si128((__m128i *)dst + 2, v);
+            _mm_stream_si128((__m128i *)dst + 3, v);
+        }
+        _mm_sfence();
+    } else {
+        for (; n >= 16; n -= 16, dst += 16) {
+            _mm_store_si128((__m128i *)dst, v);
+            _mm_store_si128((__m128i *)dst + 1, v);
+            _mm_store_si128((__m128i *)dst + 2, v);
+            _mm_store_si128((__m128i *)dst + 3, v);
+        }
+    }
+    for (; n >= 4; n -= 4, dst += 4)
+        _mm_store_si128((__m128i *)dst, v);
+    while (n--)
+        *dst++ = value;
+}
+
+__attribute__((target("sse2")))
+static void span_sse2(uint32_t *dst, size_t n, uint32_t value) {
+    span_sse2_common(dst, n, value, 0);
+}
+
+__attribute__((target("sse2")))
+static void span_sse2_nt(uint32_t *dst, size_t n, uint32_t value) {
+    span_sse2_common(dst, n, value, 1);
+}
+
+/* AVX2: same shape with 32-byte registers, 128 bytes per iteration */
+__attribute__((target("avx2")))
+static inline void span_avx2_common(uint32_t *dst, size_t n, uint32_t value, int nt) {
+    while (n && ((uintptr_t)dst & 31)) {
+        *dst++ = value;
+        n--;
+    }
+    __m256i v = _mm256_set1_epi32((int)value);
+    if (nt) {
+        for (; n >= 32; n -= 32, dst += 32) {
+            _mm256_stream_si256((__m256i *)dst, v);
+            _mm256_stream_si256((__m256i *)dst + 1, v);
+            _mm256_stream_si256((__m256i *)dst + 2, v);
+            _mm256_stream_si256((__m256i *)dst + 3, v);
+        }
+        _mm_sfence();
+    } else {
+        for (; n >= 32; n -= 32, dst += 32) {
+            _mm256_store_si256((__m256i *)dst, v);
+            _mm256_store_si256((__m256i *)dst + 1, v);
+            _mm256_store_si256((__m256i *)dst + 2, v);
+            _mm256_store_si256((__m256i *)dst + 3, v);
+        }
+    }
+    for (; n >= 8; n -= 8, dst += 8)
+        _mm256_store_si256((__m256i *)dst, v);
+    while (n--)
+        *dst++ = value;
+}
+
+__attribute__((target("avx2")))
+static void span_avx2(uint32_t *dst, size_t n, uint32_t value) {
+    span_avx2_common(dst, n, value, 0);
+}
+
+__attribute__((target("avx2")))
+static void span_avx2_nt(uint32_t *dst, size_t n, uint32_t value) {
+    span_avx2_common(dst, n, value, 1);
+}
+#endif
+
+static const fb_fill_engine_t engines[] = {
+#ifdef FB_FILL_X86
+    { "avx2", span_avx2, span_avx2_nt },
+    { "sse2", span_sse2, span_sse2_nt },
+#endif
+    { "scalar", span_scalar, span_scalar },
+};
+
+static const fb_fill_engine_t *active_engine;
+
+/* Internal: whether the running CPU can execute an engine's kernels */
+static int engine_supported(const fb_fill_engine_t *e) {
+#ifdef FB_FILL_X86
+    __builtin_cpu_init();
+    if (strcmp(e->name, "avx2") == 0)
+        return __builtin_cpu_supports("avx2");
+    if (strcmp(e->name, "sse2") == 0)
+        return __builtin_cpu_supports("sse2");
+#endif
+    return strcmp(e->name, "scalar") == 0;
+}
+
+/* Return the fastest supported engine, selecting it on first use */
+const fb_fill_engine_t *fb_fill_engine(void) {
+    if (!active_engine) {
+        for (size_t i = 0; i < sizeof(engines) / sizeof(engines[0]); i++) {
+            if (engine_supported(&engines[i])) {
+                active_engine = &engines[i];
+                break;
+            }
+        }
+    }
+    return active_engine;
+}
+
+/* Force a specific engine by name (for benchmarking); -1 if unavailable */
+int fb_fill_select(const char *name) {
+    for (size_t i = 0; i < sizeof(engines) / sizeof(engines[0]); i++) {
+        if (strcmp(engines[i].name, name) == 0 && engine_supported(&engines[i])) {
+            active_engine = &engines[i];
+            return 0;
+        }
+    }
+    return -1;
+}
+
+void fb_fill_span32(uint8_t *dst, int n, uint32_t pixel) {
+    fb_fill_engine()->span((uint32_t *)dst, n, pixel);
+}
+
+/* Internal: 16 bpp spans are filled as pairs of pixels once 4-byte aligned */
+static void span16_with(void (*span)(uint32_t *, size_t, uint32_t), uint8_t *dst, int n, uint32_t pixel) {
+    uint16_t *p = (uint16_t *)dst;
+    if (n > 0 && ((uintptr_t)p & 2)) {
+        *p++ = (uint16_t)pixel;
+        n--;
+    }
+    if (n >= 2)
+        span((uint32_t *)p, n / 2, (pixel & 0xFFFF) * 0x10001u);
+    if (n & 1)
+        p[n - 1] = (uint16_t)pixel;
+}
+
+void fb_fill_span16(uint8_t *dst, int n, uint32_t pixel) {
+    span16_with(fb_fill_engine()->span, dst, n, pixel);
+}
+
+void fb_fill_rect32(uint8_t *dst, size_t stride, int w, int h, uint32_t pixel) {
+    const fb_fill_engine_t *e = fb_fill_engine();
+    size_t bytes = (size_t)w * h * 4;
+    void (*span)(uint32_t *, size_t, uint32_t) = bytes >= FB_FILL_NT_THRESHOLD ? e->span_nt : e->span;
+    if (stride == (size_t)w * 4) {
+        span((uint32_t *)dst, (size_t)w * h, pixel);
+        return;
+    }
+    for (int j = 0; j < h; j++, dst += stride)
+        span((uint32_t *)dst, w, pixel);
+}
+
+void fb_fill_rect16(uint8_t *dst, size_t stride, int w, int h, uint32_t pixel) {
+    const fb_fill_engine_t *e = fb_fill_engine();
+    size_t bytes = (size_t)w * h * 2;
+    void (*span)(uint32_t *, size_t, uint32_t) = bytes >= FB_FILL_NT_THRESHOLD ? e->span_nt : e->span;
+    for (int j = 0; j < h; j++, dst += stride)
+        span16_with(span, dst, w, pixel);
+}
+
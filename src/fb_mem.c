@@ -0,0 +1,70 @@
+#include "fb_backend.h"
+#include "fb_blit.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Headless backend: the "screen" is a plain heap buffer of any size and
+   depth, so the renderer can run and be measured without /dev/fb0.  Frames
+   can be inspected with fb_dump_ppm(). */
+
+static int mem_init(framebuffer_t *fb, const char *spec) {
+    int width = 0, height = 0, bpp = 32;
+    if (sscanf(spec, "%dx%dx%d", &width, &height, &bpp) < 2 || width <= 0 || height <= 0) {
+        fprintf(stderr, "Invalid memory framebuffer spec '%s' (want WxH[xBPP])\n", spec);
+        return -1;
+    }
+    if (!fb_ops_for_bpp(bpp)) {
+        fprintf(stderr, "Unsupported framebuffer depth: %d bpp\n", bpp);
+        return -1;
+    }
+    fb->fb_fd = -1;
+    fb->width = width;
+    fb->height = height;
+    fb->bpp = bpp;
+    fb->format.bytes_per_pixel = bpp / 8;
+    if (bpp == 16) {
+        fb->format.red_offset = 11;
+        fb->format.red_length = 5;
+        fb->format.green_offset = 5;
+        fb->format.green_length = 6;
+        fb->format.blue_offset = 0;
+        fb->format.blue_length = 5;
+    } else {
+        fb->format.red_offset = 16;
+        fb->format.red_length = 8;
+        fb->format.green_offset = 8;
+        fb->format.green_length = 8;
+        fb->format.blue_offset = 0;
+        fb->format.blue_length = 8;
+    }
+    fb->vram_stride = (size_t)width * fb->format.bytes_per_pixel;
+    fb->fb_size = fb->vram_stride * height;
+    fb->fb_ptr = calloc(1, fb->fb_size);
+    if (!fb->fb_ptr) {
+        perror("calloc memory framebuffer");
+        return -1;
+    }
+    fb->vram = fb->fb_ptr;
+    fb->pages = 1;
+    fb->front = 0;
+    fb->vsync = 0;
+    fb->vinfo_changed = 0;
+    fb->prev_damage_count = 0;
+    return 0;
+}
+
+static void mem_present(framebuffer_t *fb) {
+    if (fb->shadow)
+        fb_copy_rects(fb, fb->vram, fb->vram_stride, fb->damage, fb->damage_count);
+}
+
+static void mem_close(framebuffer_t *fb) {
+    free(fb->fb_ptr);
+    fb->fb_ptr = NULL;
+    fb->vram = NULL;
+}
+
+const fb_backend_t fb_backend_memory = {
+    "memory", mem_init, mem_present, mem_close, NULL, NULL
+};
+
@@ -0,0 +1,114 @@
+#include "font.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include "font8x8_basic.h"
+
+/* Atlases are immutable once built and shared by every framebuffer using
+   the same scale. */
+static font_atlas_t atlases[FONT_MAX_SCALE + 1];
+static font_outline_t outlines[FONT_MAX_SCALE + 1][FONT_MAX_OUTLINE + 1];
+
+/* Pick a scale so text keeps roughly the size it has at 1080p at scale 2 */
+int font_scale_for_height(int height) {
+    int scale = (height + 539) / 540;
+    if (scale < 1)
+        scale = 1;
+    if (scale > FONT_MAX_SCALE)
+        scale = FONT_MAX_SCALE;
+    return scale;
+}
+
+/* Internal: widen each bit of an 8-bit font row to `scale` bits */
+static uint64_t scale_row(uint8_t bits, int scale) {
+    uint64_t run = ((uint64_t)1 << scale) - 1;
+    uint64_t mask = 0;
+    for (int col = 0; col < 8; col++) {
+        if (bits & (1 << col))
+            mask |= run << (col * scale);
+    }
+    return mask;
+}
+
+static int font_atlas_build(font_atlas_t *font, int scale) {
+    font->cell_w = 8 * scale;
+    font->cell_h = 8 * scale;
+    font->rows = calloc((size_t)FONT_GLYPHS * font->cell_h, sizeof(uint64_t));
+    if (!font->rows) {
+        perror("calloc font atlas");
+        return -1;
+    }
+    for (int g = 0; g < FONT_GLYPHS; g++) {
+        uint64_t *rows = font->rows + (size_t)g * font->cell_h;
+        int first = font->cell_h, last = -1;
+        for (int row = 0; row < 8; row++) {
+            uint64_t mask = scale_row((uint8_t)font8x8_basic[g][row], scale);
+            for (int dy = 0; dy < scale; dy++)
+                rows[row * scale + dy] = mask;
+            if (mask) {
+                if (first > row * scale)
+                    first = row * scale;
+                last = row * scale + scale - 1;
+            }
+        }
+        /* Blank glyphs get an empty range (first > last) */
+        font->first_row[g] = (uint8_t)(last < 0 ? 1 : first);
+        font->last_row[g] = (uint8_t)(last < 0 ? 0 : last);
+    }
+    font->scale = scale;
+    return 0;
+}
+
+/* Return the atlas for a scale, building it on first use; NULL on failure */
+const font_atlas_t *font_atlas_get(int scale) {
+    if (scale < 1)
+        scale = 1;
+    if (scale > FONT_MAX_SCALE)
+        scale = FONT_MAX_SCALE;
+    font_atlas_t *font = &atlases[scale];
+    if (!font->rows && font_atlas_build(font, scale) < 0)
+        return NULL;
+    return font;
+}
+
+static int font_outline_build(font_outline_t *outline, const font_atlas_t *font, int radius) {
+    outline->cell_w = font->cell_w + 2 * radius;
+    outline->cell_h = font->cell_h + 2 * radius;
+    outline->rows = calloc((size_t)FONT_GLYPHS * outline->cell_h, sizeof(uint64_t));
+    if (!outline->rows) {
+        perror("calloc font outline");
+        return -1;
+    }
+    for (int g = 0; g < FONT_GLYPHS; g++) {
+        const uint64_t *src = font->rows + (size_t)g * font->cell_h;
+        uint64_t *dst = outline->rows + (size_t)g * outline->cell_h;
+        for (int row = 0; row < font->cell_h; row++) {
+            if (!src[row])
+                continue;
+            /* Widen horizontally, then smear over 2 * radius + 1 rows */
+            uint64_t wide = 0;
+            for (int dx = 0; dx <= 2 * radius; dx++)
+                wide |= src[row] << dx;
+            for (int dy = 0; dy <= 2 * radius; dy++)
+                dst[row + dy] |= wide;
+        }
+    }
+    outline->radius = radius;
+    return 0;
+}
+
+/* Return the dilated masks for an atlas and radius, building them on first
+   use.  The radius is clamped so the outline never reaches past the
+   neighbouring glyph cell. */
+const font_outline_t *font_outline_get(const font_atlas_t *font, int radius) {
+    if (radius < 1)
+        radius = 1;
+    if (radius > FONT_MAX_OUTLINE)
+        radius = FONT_MAX_OUTLINE;
+    if (radius > font->cell_w)
+        radius = font->cell_w;
+    font_outline_t *outline = &outlines[font->scale][radius];
+    if (!outline->rows && font_outline_build(outline, font, radius) < 0)
+        return NULL;
+    return outline;
+}
+
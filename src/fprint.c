@@ -0,0 +1,344 @@
+#include "fprint.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <paths.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <utmp.h>
+
+#define FPRINT_LIST "/usr/bin/fprintd-list"
+#define FPRINT_VERIFY "/usr/bin/fprintd-verify"
+#define FPRINT_STORAGE_PARENT "/var/lib"
+#define FPRINT_STORAGE_NAME "fprint"
+#define FPRINT_STORAGE FPRINT_STORAGE_PARENT "/" FPRINT_STORAGE_NAME
+#define FPRINT_CACHE_SIZE 16
+#define FPRINT_CACHE_TTL 300        /* seconds; the backstop when inotify misses a change */
+#define FPRINT_WATCH_DEPTH 3        /* <user>/<driver>/<device> below the storage root */
+#define FPRINT_WTMP_SCAN 1024       /* records looked at for recent users */
+#define FPRINT_WATCH_MASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+                           IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF)
+
+extern char **environ;
+
+typedef struct {
+    char user[256];
+    char finger[64];
+    int enrolled;
+    int pending;                /* fprintd-list is running for this user */
+    time_t expires;             /* 0: empty slot */
+} fprint_entry_t;
+
+static fprint_entry_t fprint_cache[FPRINT_CACHE_SIZE];
+static unsigned fprint_generation;      /* bumped by every flush */
+static int fprint_tools = -1;   /* -1: not checked yet */
+static time_t fprint_tools_expires;
+static int fprint_inotify = -1;
+static int fprint_parent_wd = -1;
+/* Lookups also come from the account worker thread.  The cache lock is
+   never held while fprintd-list runs, so the UI thread only ever waits
+   for a few compares; fprint_cond wakes lookups waiting on a pending
+   entry.  The tools check has a lock of its own. */
+static pthread_mutex_t fprint_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t fprint_cond = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t fprint_tools_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static time_t fprint_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+/* Internal: Watch a directory and those below it, depth levels deep */
+static void fprint_watch_tree(const char *path, int depth) {
+    if (inotify_add_watch(fprint_inotify, path, FPRINT_WATCH_MASK | IN_ONLYDIR) < 0 || depth == 0)
+        return;
+    DIR *dir = opendir(path);
+    if (!dir)
+        return;
+    struct dirent *de;
+    while ((de = readdir(dir)) != NULL) {
+        if (de->d_name[0] == '.' || (de->d_type != DT_DIR && de->d_type != DT_UNKNOWN))
+            continue;
+        char sub[512];
+        snprintf(sub, sizeof(sub), "%s/%s", path, de->d_name);
+        fprint_watch_tree(sub, depth - 1);
+    }
+    closedir(dir);
+}
+
+/* Internal: Forget every cached answer and pick up new directories.
+   Pending entries are left to their lookups, which see the new generation
+   and do not cache what they found. */
+static void fprint_flush(void) {
+    pthread_mutex_lock(&fprint_lock);
+    for (int i = 0; i < FPRINT_CACHE_SIZE; i++) {
+        if (!fprint_cache[i].pending)
+            memset(&fprint_cache[i], 0, sizeof(fprint_cache[i]));
+    }
+    fprint_generation++;
+    pthread_mutex_unlock(&fprint_lock);
+    pthread_mutex_lock(&fprint_tools_lock);
+    fprint_tools = -1;
+    pthread_mutex_unlock(&fprint_tools_lock);
+    if (fprint_inotify >= 0)
+        fprint_watch_tree(FPRINT_STORAGE, FPRINT_WATCH_DEPTH);
+}
+
+/* Public: Set up the storage watch.  Returns 0, or -1 if inotify is not
+   available, in which case entries only expire by their TTL. */
+int fprint_init(void) {
+    fprint_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fprint_inotify < 0) {
+        perror("inotify_init1");
+        return -1;
+    }
+    /* The storage directory only appears with the first enrollment */
+    fprint_parent_wd = inotify_add_watch(fprint_inotify, FPRINT_STORAGE_PARENT,
+                                         IN_CREATE | IN_MOVED_TO | IN_ONLYDIR);
+    fprint_watch_tree(FPRINT_STORAGE, FPRINT_WATCH_DEPTH);
+    return 0;
+}
+
+void fprint_close(void) {
+    if (fprint_inotify >= 0)
+        close(fprint_inotify);
+    fprint_inotify = -1;
+}
+
+/* Public: The inotify descriptor to poll for readability, or -1 */
+int fprint_fd(void) {
+    return fprint_inotify;
+}
+
+/* Public: Drain pending inotify events, flushing the cache if any of them
+   touched the fingerprint storage. */
+void fprint_handle_events(void) {
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    int changed = 0;
+    ssize_t len;
+    while ((len = read(fprint_inotify, buf, sizeof(buf))) > 0) {
+        for (char *p = buf; p < buf + len;) {
+            const struct inotify_event *ev = (const struct inotify_event *)p;
+            if (ev->wd != fprint_parent_wd || (ev->len && strcmp(ev->name, FPRINT_STORAGE_NAME) == 0) ||
+                (ev->mask & IN_Q_OVERFLOW))
+                changed = 1;
+            p += sizeof(*ev) + ev->len;
+        }
+    }
+    if (changed)
+        fprint_flush();
+}
+
+/* Public: Are the fprintd tools installed? */
+int fprint_available(void) {
+    time_t now = fprint_now();
+    pthread_mutex_lock(&fprint_tools_lock);
+    if (fprint_tools < 0 || now >= fprint_tools_expires) {
+        fprint_tools = access(FPRINT_LIST, X_OK) == 0 && access(FPRINT_VERIFY, X_OK) == 0;
+        fprint_tools_expires = now + FPRINT_CACHE_TTL;
+    }
+    int available = fprint_tools;
+    pthread_mutex_unlock(&fprint_tools_lock);
+    return available;
+}
+
+/* Internal: Run fprintd-list without a shell and take the first enrolled
+   finger from its output.  Returns 1 if enrolled, 0 if not, -1 on error. */
+static int fprint_list(const char *username, char *finger, size_t size) {
+    int pipefd[2];
+    if (pipe(pipefd) < 0) {
+        perror("pipe");
+        return -1;
+    }
+    fcntl(pipefd[0], F_SETFD, FD_CLOEXEC);
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_adddup2(&actions, pipefd[1], STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, pipefd[1], STDERR_FILENO);
+    /* The caller blocks its signals for signalfd; the child should not */
+    posix_spawnattr_t attr;
+    sigset_t none;
+    sigemptyset(&none);
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setsigmask(&attr, &none);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+
+    char *const argv[] = { "fprintd-list", (char *)username, NULL };
+    pid_t pid;
+    int err = posix_spawn(&pid, FPRINT_LIST, &actions, &attr, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    close(pipefd[1]);
+    if (err != 0) {
+        errno = err;
+        perror("posix_spawn");
+        close(pipefd[0]);
+        return -1;
+    }
+
+    int enrolled = 0;
+    FILE *out = fdopen(pipefd[0], "r");
+    if (out) {
+        char line[1024];
+        while (fgets(line, sizeof(line), out)) {
+            char *colon;
+            if (enrolled || !strstr(line, "- #") || !(colon = strchr(line, ':')))
+                continue;   // keep draining so the child never blocks on a full pipe
+            colon++;
+            while (*colon == ' ')
+                colon++;
+            colon[strcspn(colon, "\n")] = '\0';
+            snprintf(finger, size, "%s", colon);
+            enrolled = 1;
+        }
+        fclose(out);
+    } else {
+        close(pipefd[0]);
+    }
+    while (waitpid(pid, NULL, 0) < 0 && errno == EINTR)
+        ;
+    return enrolled;
+}
+
+/* Public: Look up the first enrolled finger of a user.  Returns 0 and fills
+   finger if there is one, -1 otherwise.  Answers (including "none") are
+   cached until they expire or the storage changes; concurrent lookups of
+   the same user wait for each other rather than spawning fprintd-list
+   twice, but the cache is unlocked while it runs. */
+int fprint_lookup(const char *username, char *finger, size_t size) {
+    if (strlen(username) >= sizeof(fprint_cache[0].user))
+        return -1;
+    pthread_mutex_lock(&fprint_lock);
+    fprint_entry_t *slot;
+    for (;;) {
+        time_t now = fprint_now();
+        fprint_entry_t *match = NULL;
+        slot = NULL;
+        for (int i = 0; i < FPRINT_CACHE_SIZE; i++) {
+            fprint_entry_t *e = &fprint_cache[i];
+            if ((e->pending || e->expires > now) && strcmp(e->user, username) == 0) {
+                match = e;
+                break;
+            }
+            // Empty and stale slots sort first, then the one closest to expiry.
+            if (!e->pending && (!slot || e->expires < slot->expires))
+                slot = e;
+        }
+        if (!match)
+            break;
+        if (match->pending) {
+            pthread_cond_wait(&fprint_cond, &fprint_lock);
+            continue;
+        }
+        int ret = match->enrolled ? 0 : -1;
+        if (match->enrolled)
+            snprintf(finger, size, "%s", match->finger);
+        pthread_mutex_unlock(&fprint_lock);
+        return ret;
+    }
+    if (!slot) {                // every slot has a lookup in flight
+        pthread_mutex_unlock(&fprint_lock);
+        return -1;
+    }
+    memset(slot, 0, sizeof(*slot));
+    snprintf(slot->user, sizeof(slot->user), "%s", username);
+    slot->pending = 1;
+    unsigned generation = fprint_generation;
+    pthread_mutex_unlock(&fprint_lock);
+
+    char found[sizeof(slot->finger)] = "";
+    int enrolled = fprint_list(username, found, sizeof(found));
+
+    pthread_mutex_lock(&fprint_lock);
+    slot->pending = 0;
+    if (enrolled < 0 || generation != fprint_generation) {
+        slot->user[0] = '\0';  // not cached: the next attempt may do better
+    } else {
+        memcpy(slot->finger, found, sizeof(found));
+        slot->enrolled = enrolled;
+        slot->expires = fprint_now() + FPRINT_CACHE_TTL;
+    }
+    pthread_cond_broadcast(&fprint_cond);
+    pthread_mutex_unlock(&fprint_lock);
+    if (enrolled <= 0)
+        return -1;
+    snprintf(finger, size, "%s", found);
+    return 0;
+}
+
+/* Public: The cached answer for a user, without ever running
+   fprintd-list.  Returns 1 and fills finger (if given) when a finger is
+   enrolled, 0 when none is, or -1 when there is no fresh answer. */
+int fprint_cached(const char *username, char *finger, size_t size) {
+    time_t now = fprint_now();
+    int ret = -1;
+    pthread_mutex_lock(&fprint_lock);
+    for (int i = 0; i < FPRINT_CACHE_SIZE; i++) {
+        const fprint_entry_t *e = &fprint_cache[i];
+        if (!e->pending && e->expires > now && strcmp(e->user, username) == 0) {
+            ret = e->enrolled;
+            if (ret && finger)
+                snprintf(finger, size, "%s", e->finger);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&fprint_lock);
+    return ret;
+}
+
+/* Public: Warm the cache for the users who logged in most recently,
+   newest first, according to wtmp. */
+void fprint_prefetch_recent(int max_users) {
+    if (!fprint_available())
+        return;
+    int fd = open(_PATH_WTMP, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return;
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return;
+    }
+    if (max_users > FPRINT_CACHE_SIZE)
+        max_users = FPRINT_CACHE_SIZE;
+
+    char users[FPRINT_CACHE_SIZE][UT_NAMESIZE + 1];
+    int count = 0;
+    struct utmp records[64];
+    off_t end = st.st_size / sizeof(struct utmp) * sizeof(struct utmp);
+    for (int scanned = 0; end > 0 && count < max_users && scanned < FPRINT_WTMP_SCAN;) {
+        off_t start = end - (off_t)sizeof(records) > 0 ? end - (off_t)sizeof(records) : 0;
+        ssize_t got = pread(fd, records, end - start, start);
+        if (got != end - start)
+            break;
+        end = start;
+        for (int i = got / sizeof(struct utmp) - 1; i >= 0 && count < max_users; i--, scanned++) {
+            const struct utmp *ut = &records[i];
+            if (ut->ut_type != USER_PROCESS || ut->ut_user[0] == '\0')
+                continue;
+            char name[UT_NAMESIZE + 1];
+            memcpy(name, ut->ut_user, UT_NAMESIZE);
+            name[UT_NAMESIZE] = '\0';
+            int seen = 0;
+            for (int j = 0; j < count && !seen; j++)
+                seen = strcmp(users[j], name) == 0;
+            if (!seen)
+                memcpy(users[count++], name, sizeof(name));
+        }
+    }
+    close(fd);
+
+    char finger[64];
+    for (int i = 0; i < count; i++)
+        fprint_lookup(users[i], finger, sizeof(finger));
+}
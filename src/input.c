@@ -1,39 +1,286 @@
 #include "input.h"
+#include "trace.h"
+#include <errno.h>
+#include <string.h>
+#include <sys/ioctl.h>
 #include <termios.h>
 #include <unistd.h>
 #include <stdio.h>
 
-static struct termios orig_termios;
-
-int input_init() {
-    if (tcgetattr(STDIN_FILENO, &orig_termios) < 0) {
+/* Put a terminal into raw-ish mode: no line editing, no echo.  With
+   signals off, Ctrl-C and friends arrive as KEY_CTRL like any other key
+   (needed when the terminal is not our controlling one).  Returns 0, or
+   -1 if the terminal could not be set up. */
+int input_init(input_t *in, int fd, int signals) {
+    memset(in, 0, sizeof(*in));
+    in->fd = fd;
+    in->is_tty = isatty(fd);
+    if (!in->is_tty)
+        return 0;
+    if (tcgetattr(fd, &in->orig_termios) < 0) {
         perror("tcgetattr");
         return -1;
     }
-    struct termios raw = orig_termios;
+    struct termios raw = in->orig_termios;
     raw.c_lflag &= ~(ICANON | ECHO); // disable canonical mode and echo
-    if (tcsetattr(STDIN_FILENO, TCSANOW, &raw) < 0) {
+    if (!signals)
+        raw.c_lflag &= ~ISIG;
+    if (tcsetattr(fd, TCSANOW, &raw) < 0) {
         perror("tcsetattr");
         return -1;
     }
     return 0;
 }
 
-int input_restore() {
-    if (tcsetattr(STDIN_FILENO, TCSANOW, &orig_termios) < 0) {
+int input_restore(input_t *in) {
+    if (!in->is_tty)
+        return 0;
+    if (tcsetattr(in->fd, TCSANOW, &in->orig_termios) < 0) {
         perror("tcsetattr restore");
         return -1;
     }
     return 0;
 }
 
-int input_getchar() {
-    char c;
-    ssize_t n = read(STDIN_FILENO, &c, 1);
-    if (n < 0) {
+/* Internal: Decode one escape sequence starting at s[0] == ESC.  Returns the
+   bytes consumed, or 0 if the sequence is incomplete. */
+static int input_decode_escape(const unsigned char *s, int n, key_event_t *key) {
+    key->type = KEY_ESCAPE;
+    key->code = 0;
+    if (n < 2)
+        return 0;
+    if (s[1] != '[' && s[1] != 'O')
+        return 1;   // a lone ESC followed by an ordinary key
+    /* CSI / SS3: parameter bytes, then a final byte in 0x40..0x7E */
+    int i = 2;
+    while (i < n && (s[i] < 0x40 || s[i] > 0x7E))
+        i++;
+    if (i >= n)
+        return 0;
+    int param = 0;
+    for (int j = 2; j < i && s[j] >= '0' && s[j] <= '9'; j++)
+        param = param * 10 + (s[j] - '0');
+    switch (s[i]) {
+    case 'A': key->type = KEY_UP; break;
+    case 'B': key->type = KEY_DOWN; break;
+    case 'C': key->type = KEY_RIGHT; break;
+    case 'D': key->type = KEY_LEFT; break;
+    case 'H': key->type = KEY_HOME; break;
+    case 'F': key->type = KEY_END; break;
+    case '~':
+        if (param == 1 || param == 7)
+            key->type = KEY_HOME;
+        else if (param == 4 || param == 8)
+            key->type = KEY_END;
+        else if (param == 3)
+            key->type = KEY_DELETE;
+        break;
+    default:
+        break;      // unknown sequence: swallowed as a bare ESC
+    }
+    return i + 1;
+}
+
+/* Internal: Decode one UTF-8 character.  Returns the bytes consumed, 0 if
+   incomplete; malformed bytes are consumed one at a time as U+FFFD, and a
+   complete sequence that is overlong, a surrogate or beyond U+10FFFF
+   becomes a single U+FFFD. */
+static int input_decode_utf8(const unsigned char *s, int n, uint32_t *cp) {
+    static const uint32_t min[] = { 0, 0, 0x80, 0x800, 0x10000 };   /* by length */
+    int len = s[0] >= 0xF0 ? 4 : s[0] >= 0xE0 ? 3 : s[0] >= 0xC0 ? 2 : 1;
+    if (s[0] >= 0x80 && s[0] < 0xC0)
+        len = 1;
+    if (s[0] >= 0xF8) {
+        *cp = 0xFFFD;
+        return 1;
+    }
+    if (n < len)
+        return 0;
+    if (len == 1) {
+        *cp = s[0] < 0x80 ? s[0] : 0xFFFD;
+        return 1;
+    }
+    uint32_t c = s[0] & (0x7F >> len);
+    for (int i = 1; i < len; i++) {
+        if ((s[i] & 0xC0) != 0x80) {
+            *cp = 0xFFFD;
+            return 1;
+        }
+        c = (c << 6) | (s[i] & 0x3F);
+    }
+    if (c < min[len] || (c >= 0xD800 && c <= 0xDFFF) || c > 0x10FFFF)
+        c = 0xFFFD;
+    *cp = c;
+    return len;
+}
+
+/* Read everything the tty has buffered (up to max bytes) and decode it into
+   at most max keys.  Returns the number of keys, 0 if only part of a
+   sequence has arrived, or -1 on end of file or error. */
+int input_read(input_t *in, key_event_t *keys, int max) {
+    unsigned char buf[256 + sizeof(in->pending)];
+    int avail = 0;
+    if (ioctl(in->fd, FIONREAD, &avail) < 0 || avail < 1)
+        avail = 1;      // let read() report end of file or the error
+    int room = (int)sizeof(buf) - in->pending_len;
+    if (avail > room)
+        avail = room;
+    /* Every key takes at least one byte, so this keeps the keys within max */
+    if (avail > max - in->pending_len)
+        avail = max - in->pending_len > 0 ? max - in->pending_len : 1;
+    memcpy(buf, in->pending, in->pending_len);
+    ssize_t got = read(in->fd, buf + in->pending_len, avail);
+    if (got < 0) {
+        if (errno == EINTR || errno == EAGAIN)
+            return 0;
         perror("read");
         return -1;
     }
-    return c;
+    if (got == 0)
+        return -1;
+    trace_input();
+
+    int n = in->pending_len + (int)got, pos = 0, count = 0;
+    in->pending_len = 0;
+    while (pos < n && count < max) {
+        const unsigned char *s = buf + pos;
+        key_event_t *key = &keys[count];
+        int used = 1;
+        key->code = 0;
+        if (s[0] == 0x1B) {
+            used = input_decode_escape(s, n - pos, key);
+            /* A lone ESC at the end of a read is the Escape key itself */
+            if (used == 0 && n - pos == 1)
+                used = 1;
+        } else if (s[0] == '\r' || s[0] == '\n') {
+            key->type = KEY_ENTER;
+        } else if (s[0] == '\t') {
+            key->type = KEY_TAB;
+        } else if (s[0] == 127 || s[0] == 8) {
+            key->type = KEY_BACKSPACE;
+        } else if (s[0] < 32) {
+            key->type = KEY_CTRL;
+            key->code = s[0];
+        } else {
+            key->type = KEY_CHAR;
+            used = input_decode_utf8(s, n - pos, &key->code);
+            /* Controls are not text: never let one (least of all a NUL,
+               which would cut the field short) into a field */
+            if (used > 0 && (key->code < 0x20 || (key->code >= 0x7F && key->code < 0xA0))) {
+                pos += used;
+                continue;
+            }
+        }
+        if (used == 0) {
+            if (n - pos > (int)sizeof(in->pending))
+                break;  // garbage that never completes: drop it
+            in->pending_len = n - pos;
+            memcpy(in->pending, s, in->pending_len);
+            break;
+        }
+        pos += used;
+        count++;
+    }
+    return count;
+}
+
+void input_field_clear(input_field_t *field) {
+    memset(field->text, 0, sizeof(field->text));
+    field->len = field->cursor = 0;
+}
+
+/* Internal: Step from a byte offset to the neighbouring code point */
+static int input_field_next(const input_field_t *field, int at) {
+    do
+        at++;
+    while (at < field->len && ((unsigned char)field->text[at] & 0xC0) == 0x80);
+    return at;
+}
+
+static int input_field_prev(const input_field_t *field, int at) {
+    do
+        at--;
+    while (at > 0 && ((unsigned char)field->text[at] & 0xC0) == 0x80);
+    return at;
+}
+
+/* Internal: Remove the bytes [from, to) */
+static void input_field_cut(input_field_t *field, int from, int to) {
+    memmove(field->text + from, field->text + to, field->len - to + 1);
+    field->len -= to - from;
+}
+
+/* Apply an editing key (characters, Backspace, Delete, cursor motion) to a
+   field.  Returns 1 if the key was handled, 0 if it means nothing here. */
+int input_field_edit(input_field_t *field, const key_event_t *key) {
+    switch (key->type) {
+    case KEY_CHAR: {
+        unsigned char enc[4];
+        uint32_t c = key->code;
+        int n;
+        if (c < 0x80) {
+            enc[0] = c;
+            n = 1;
+        } else if (c < 0x800) {
+            enc[0] = 0xC0 | (c >> 6);
+            enc[1] = 0x80 | (c & 0x3F);
+            n = 2;
+        } else if (c < 0x10000) {
+            enc[0] = 0xE0 | (c >> 12);
+            enc[1] = 0x80 | ((c >> 6) & 0x3F);
+            enc[2] = 0x80 | (c & 0x3F);
+            n = 3;
+        } else {
+            enc[0] = 0xF0 | (c >> 18);
+            enc[1] = 0x80 | ((c >> 12) & 0x3F);
+            enc[2] = 0x80 | ((c >> 6) & 0x3F);
+            enc[3] = 0x80 | (c & 0x3F);
+            n = 4;
+        }
+        if (field->len + n >= INPUT_FIELD_MAX)
+            return 1;
+        memmove(field->text + field->cursor + n, field->text + field->cursor,
+                field->len - field->cursor + 1);
+        memcpy(field->text + field->cursor, enc, n);
+        field->len += n;
+        field->cursor += n;
+        return 1;
+    }
+    case KEY_BACKSPACE:
+        if (field->cursor > 0) {
+            int prev = input_field_prev(field, field->cursor);
+            input_field_cut(field, prev, field->cursor);
+            field->cursor = prev;
+        }
+        return 1;
+    case KEY_DELETE:
+        if (field->cursor < field->len)
+            input_field_cut(field, field->cursor, input_field_next(field, field->cursor));
+        return 1;
+    case KEY_LEFT:
+        if (field->cursor > 0)
+            field->cursor = input_field_prev(field, field->cursor);
+        return 1;
+    case KEY_RIGHT:
+        if (field->cursor < field->len)
+            field->cursor = input_field_next(field, field->cursor);
+        return 1;
+    case KEY_HOME:
+        field->cursor = 0;
+        return 1;
+    case KEY_END:
+        field->cursor = field->len;
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/* Number of code points in the first `bytes` bytes of a field */
+int input_field_chars(const input_field_t *field, int bytes) {
+    int n = 0;
+    for (int i = 0; i < bytes && i < field->len; i++)
+        n += ((unsigned char)field->text[i] & 0xC0) != 0x80;
+    return n;
 }
 
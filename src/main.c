@@ -2,322 +2,1155 @@
 #include "input.h"
 #include "pam_auth.h"
 #include "ui.h"
+#include "trace.h"
+#include "event.h"
+#include "fprint.h"
+#include "account.h"
 #include <libgen.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <signal.h>
-#include <pwd.h>
+#include <sys/ioctl.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
 #include <grp.h>
 #include <sys/mman.h>
 #include "version.h"
 #include <sys/stat.h>
 
-#define MAX_INPUT 256
+#define MAX_INPUT INPUT_FIELD_MAX
+#define MAX_KEYS 64
+#define MAX_SEATS UI_MAX_SEATS
+#define PREFETCH_PAUSE_MS 250   // typing pause before the username is looked up
+#define SPINNER_MS 100
+#define WELCOME_MS 1000
+#define TOAST_MS 2000
+#define FINGERPRINT_HINT "Touch the sensor or type your password"
 
-static framebuffer_t fb;
-volatile sig_atomic_t restart_requested = 0;
+/* The login screen is a state machine driven by the event loop: tty input,
+   signals, timers and the fingerprint child all arrive as events, and the
+   process sleeps in epoll_wait whenever nothing is happening.  Fingerprint
+   verification runs alongside the password field rather than as a state of
+   its own: whichever method succeeds first wins. */
+typedef enum {
+    STATE_EDITING,          /* typing into the username or password field */
+    STATE_AUTH,             /* PAM is working; Escape cancels */
+    STATE_HOLD,             /* the welcome stays up until the session starts */
+    STATE_SESSION           /* daemon mode: a user's session owns the tty */
+} login_state_t;
 
-int is_fprintd_available() {
-    return (access("/usr/bin/fprintd-list", X_OK) == 0);
+/* One terminal and screen with a login prompt on it.  Normally there is a
+   single seat on the tty fblogin was started on, and a successful login
+   turns the process into the user's shell.  In daemon mode (--seat) one
+   process serves several, each with its own keyboard state and PAM worker
+   while glyph atlases, backgrounds and account lookups are shared, and
+   every session runs in a child of its own. */
+typedef struct {
+    char tty[64];
+    char fb_device[128];
+    int tty_fd;
+    framebuffer_t fb;
+    input_t input;
+    auth_t auth;
+    int auth_async;             // the PAM worker can report through auth_src
+    int slot;                   // index, for the shared account worker
+
+    login_state_t state;
+    input_field_t username;
+    input_field_t password;
+    key_event_t keys[MAX_KEYS]; // decoded keys not yet handled
+    int key_count;
+    int key_next;
+    int editing_username;       // 1 while the username field is active, 0 for the password field.
+    int session_ready;          // authenticated and the welcome hold is over
+    int fp_wanted;              // start the reader once the account lookup lands
+    pid_t fp_pid;
+    int fp_stopping;            // fp_pid was told to stop; its verdict is moot
+    int auth_prompt;            // the password field answers a PAM prompt
+    char auth_note[256];        // shown next to the spinner
+    int spin_frame;
+    uint64_t auth_start;
+    int locked;                 // a failure's delay is still running
+    int submit_pending;         // Enter came during the lockout
+    pid_t session_pid;          // daemon mode: the user's session
+
+    event_source_t input_src;
+    event_source_t hold_src;
+    event_source_t fp_src;
+    event_source_t prefetch_src;
+    event_source_t auth_src;
+    event_source_t spin_src;
+    event_source_t lockout_src;
+    event_source_t session_src;
+} seat_t;
+
+static seat_t seats[MAX_SEATS];
+static int seat_count;
+static int daemon_mode;         /* sessions are forked and the prompt comes back */
+static int use_vsync = 1;
+static event_loop_t loop;
+static sigset_t orig_sigmask;
+
+static void on_input(event_source_t *src, uint32_t events);
+static void on_signal(event_source_t *src, uint32_t events);
+static void on_hold_timer(event_source_t *src, uint32_t events);
+static void on_anim_timer(event_source_t *src, uint32_t events);
+static void on_fingerprint_exit(event_source_t *src, uint32_t events);
+static void on_fprint_change(event_source_t *src, uint32_t events);
+static void on_prefetch_timer(event_source_t *src, uint32_t events);
+static void on_account_ready(event_source_t *src, uint32_t events);
+static void on_auth_event(event_source_t *src, uint32_t events);
+static void on_spin_timer(event_source_t *src, uint32_t events);
+static void on_lockout_timer(event_source_t *src, uint32_t events);
+static void on_session_exit(event_source_t *src, uint32_t events);
+
+static event_source_t signal_src = { -1, on_signal, NULL };
+static event_source_t anim_src = { -1, on_anim_timer, NULL };
+static event_source_t fprint_src = { -1, on_fprint_change, NULL };
+static event_source_t account_src = { -1, on_account_ready, NULL };
+
+/* Write a terminal control sequence, unless the seat reads from something
+   that is not a terminal (a pipe under test) */
+static void tty_write(seat_t *seat, const char *seq) {
+    if (seat->input.is_tty && write(seat->tty_fd, seq, strlen(seq)) < 0)
+        perror("write tty");
 }
 
 void restore_and_exit(int exit_status) {
-    printf("\e[?25h");
-    fflush(stdout);
-    input_restore();
-    fb_clear(&fb, 0x000000);
-    fb_close(&fb);
+    for (int i = 0; i < seat_count; i++) {
+        seat_t *seat = &seats[i];
+        if (seat->state == STATE_SESSION)
+            continue;
+        tty_write(seat, "\e[?25h");
+        input_restore(&seat->input);
+        fb_clear(&seat->fb, 0x000000);
+        fb_present(&seat->fb);
+        fb_close(&seat->fb);
+    }
+    trace_dump();
     exit(exit_status);
 }
 
-void restart_handler(int signum) {
-    (void)signum;
-    restart_requested = 1;
+/* Keep the welcome up for ms milliseconds, then start the session.  Every
+   other message is a toast over the live login screen. */
+static void hold(seat_t *seat, int ms) {
+    seat->state = STATE_HOLD;
+    event_modify(&loop, &seat->input_src, 0);
+    event_timer_arm(seat->hold_src.fd, ms);
+}
+
+static void reset_prompt(seat_t *seat) {
+    input_field_clear(&seat->username);
+    input_field_clear(&seat->password);
+    seat->editing_username = 1;
+    seat->fp_wanted = 0;
+    ui_set_status(&seat->fb, NULL);
+}
+
+/* Draw both fields with the cursor in the active one */
+static void draw_login(seat_t *seat) {
+    const input_field_t *active = seat->editing_username ? &seat->username : &seat->password;
+    ui_draw_login(&seat->fb, seat->username.text, seat->password.text, !seat->editing_username,
+                  input_field_chars(active, active->cursor));
+}
+
+static void process_keys(seat_t *seat);
+
+/* Back to the fields: resume reading keys and redraw */
+static void resume_editing(seat_t *seat) {
+    seat->state = STATE_EDITING;
+    event_modify(&loop, &seat->input_src, EPOLLIN);
+    process_keys(seat);
+}
+
+/* Start fingerprint verification in the background while the password
+   field stays live, if the fprint cache knows of an enrolled finger.
+   Returns 0 once fprintd-verify is running; its exit arrives later as an
+   event. */
+static int start_fingerprint(seat_t *seat, const char *user) {
+    char finger[64];
+    if (fprint_cached(user, finger, sizeof(finger)) != 1)
+        return -1;
+    pid_t pid = fork();
+    if (pid < 0) {
+        return -1;
+    } else if (pid == 0) {
+        sigprocmask(SIG_SETMASK, &orig_sigmask, NULL);
+        /* Keep it off the tty: the keys belong to the password field and
+           its chatter would scribble over the framebuffer console */
+        int null_fd = open("/dev/null", O_RDWR);
+        if (null_fd >= 0) {
+            dup2(null_fd, STDIN_FILENO);
+            dup2(null_fd, STDOUT_FILENO);
+            dup2(null_fd, STDERR_FILENO);
+        }
+        execl("/usr/bin/fprintd-verify", "fprintd-verify", "-f", finger, user, (char*)NULL);
+        _exit(1);
+    }
+    seat->fp_pid = pid;
+    ui_set_status(&seat->fb, FINGERPRINT_HINT);
+    /* Without pidfd support the exit is picked up from SIGCHLD instead */
+    seat->fp_src.fd = event_pidfd_open(pid);
+    if (seat->fp_src.fd >= 0 && event_add(&loop, &seat->fp_src, EPOLLIN) < 0) {
+        close(seat->fp_src.fd);
+        seat->fp_src.fd = -1;
+    }
+    return 0;
+}
+
+/* Is a fingerprint reader running whose verdict still counts? */
+static int fingerprint_running(const seat_t *seat) {
+    return seat->fp_pid > 0 && !seat->fp_stopping;
+}
+
+/* Tell the fingerprint child to stop.  It can take a while to let go of
+   the device, so it is not waited for here: its exit is reaped like any
+   other by check_fingerprint(), and its verdict ignored. */
+static void stop_fingerprint(seat_t *seat) {
+    if (fingerprint_running(seat)) {
+        kill(seat->fp_pid, SIGTERM);
+        seat->fp_stopping = 1;
+    }
+    ui_set_status(&seat->fb, NULL);
+}
+
+static void set_auth_status(seat_t *seat) {
+    static const char frames[] = "|/-\\";
+    char status[300];
+    snprintf(status, sizeof(status), "%s %c", seat->auth_note, frames[seat->spin_frame % 4]);
+    ui_set_status(&seat->fb, status);
+}
+
+/* Drop whatever authentication is in flight and put the idle status back.
+   The caller decides which state comes next. */
+static void cancel_auth(seat_t *seat) {
+    if (seat->state != STATE_AUTH && !seat->auth_prompt)
+        return;
+    auth_cancel(&seat->auth);
+    event_timer_arm(seat->spin_src.fd, -1);
+    seat->auth_prompt = 0;
+    input_field_clear(&seat->password);
+    ui_set_status(&seat->fb, fingerprint_running(seat) ? FINGERPRINT_HINT : NULL);
+}
+
+/* Authentication is over.  A failure goes straight back to the fields with
+   a toast; the delay PAM asked for becomes a lockout during which Enter is
+   held back rather than the whole screen. */
+static void finish_auth(seat_t *seat, int ret, int delay_ms) {
+    trace_end(TRACE_AUTH, seat->auth_start);
+    event_timer_arm(seat->spin_src.fd, -1);
+    seat->auth_prompt = 0;
+    input_field_clear(&seat->password);
+    ui_set_status(&seat->fb, fingerprint_running(seat) ? FINGERPRINT_HINT : NULL);
+    if (ret == 0) {
+        stop_fingerprint(seat);
+        ui_draw_welcome(&seat->fb, seat->username.text);
+        hold(seat, WELCOME_MS);
+        return;
+    }
+    if (delay_ms > 0) {
+        seat->locked = 1;
+        event_timer_arm(seat->lockout_src.fd, delay_ms);
+    }
+    ui_toast(&seat->fb, "Authentication failed. Try again.", delay_ms > TOAST_MS ? delay_ms : TOAST_MS);
+    resume_editing(seat);
+}
+
+/* Hand the password, or the answer to a PAM prompt, to the worker and spin
+   until it reports back.  PAM never runs on the event loop: it may wait on
+   another seat's transaction, and only the loop can answer prompts. */
+static void begin_auth(seat_t *seat) {
+    if (seat->auth_prompt) {
+        auth_respond(&seat->auth, seat->password.text);
+        seat->auth_prompt = 0;
+    } else {
+        seat->auth_start = trace_begin();
+        if (!seat->auth_async ||
+            auth_begin(&seat->auth, seat->username.text, seat->password.text) < 0) {
+            input_field_clear(&seat->password);
+            ui_toast(&seat->fb, "Authentication is unavailable.", TOAST_MS);
+            resume_editing(seat);
+            return;
+        }
+    }
+    input_field_clear(&seat->password);
+    seat->state = STATE_AUTH;
+    snprintf(seat->auth_note, sizeof(seat->auth_note), "Authenticating");
+    seat->spin_frame = 0;
+    set_auth_status(seat);
+    draw_login(seat);
+    event_timer_arm(seat->spin_src.fd, SPINNER_MS);
+}
+
+/* Start the reader Enter asked for, once the account lookup has landed
+   and a reader told to stop has gone.  Returns 0 if it started. */
+static int start_wanted_fingerprint(seat_t *seat) {
+    account_t acct;
+    if (!seat->fp_wanted || seat->fp_pid > 0 || account_get(seat->username.text, &acct) < 0)
+        return -1;
+    seat->fp_wanted = 0;
+    return start_fingerprint(seat, seat->username.text);
+}
+
+/* Reap the fingerprint child if it has exited and act on its verdict.  A
+   match wins over whatever is on screen; a failure just leaves the
+   password field to finish the job.  One that was told to stop only
+   makes way for the next reader. */
+static void check_fingerprint(seat_t *seat) {
+    int status;
+    if (seat->fp_pid <= 0 || waitpid(seat->fp_pid, &status, WNOHANG) != seat->fp_pid)
+        return;
+    seat->fp_pid = 0;
+    if (seat->fp_src.fd >= 0) {
+        event_remove(&loop, &seat->fp_src);
+        close(seat->fp_src.fd);
+        seat->fp_src.fd = -1;
+    }
+    if (seat->fp_stopping) {
+        seat->fp_stopping = 0;
+        if (start_wanted_fingerprint(seat) == 0 && seat->state == STATE_EDITING)
+            draw_login(seat);
+        return;
+    }
+    ui_set_status(&seat->fb, NULL);
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+        cancel_auth(seat);
+        input_field_clear(&seat->password);
+        ui_draw_welcome(&seat->fb, seat->username.text);
+        hold(seat, WELCOME_MS);
+        return;
+    }
+    ui_set_status(&seat->fb, "Fingerprint not recognised, use your password");
+    if (seat->state == STATE_EDITING)
+        draw_login(seat);
+}
+
+/* Restart the prompt from scratch, abandoning whatever was in progress.
+   A running lockout stays in force. */
+static void restart_prompt(seat_t *seat, int toast_ms) {
+    if (seat->state == STATE_SESSION)
+        return;
+    cancel_auth(seat);
+    stop_fingerprint(seat);
+    reset_prompt(seat);
+    seat->submit_pending = 0;
+    ui_toast(&seat->fb, "Restarting login prompt...", toast_ms);
+    resume_editing(seat);
+}
+
+static void handle_enter(seat_t *seat) {
+    if (seat->editing_username) {
+        // If editing username and it is nonempty, finish username phase.
+        if (seat->username.len == 0)
+            return;
+        // Switch to password phase, with the fingerprint reader racing it
+        // as soon as the account lookup (usually done already) lands.
+        seat->editing_username = 0;
+        event_timer_arm(seat->prefetch_src.fd, -1);
+        account_t acct;
+        int ready = account_get(seat->username.text, &acct) == 0;
+        seat->fp_wanted = fprint_available() && !fingerprint_running(seat);
+        if (!ready && account_request(seat->slot, seat->username.text) < 0) {
+            // No worker: look enrollment up right here
+            char finger[64];
+            ready = 1;
+            if (seat->fp_wanted)
+                fprint_lookup(seat->username.text, finger, sizeof(finger));
+        }
+        if (seat->fp_wanted && ready && seat->fp_pid == 0) {
+            seat->fp_wanted = 0;
+            start_fingerprint(seat, seat->username.text);
+        }
+    } else {
+        // If editing password and password is nonempty, try authentication.
+        // An answer to a PAM prompt may be empty.
+        if (seat->password.len == 0 && !seat->auth_prompt)
+            return;
+        if (seat->locked) {
+            seat->submit_pending = 1;
+            ui_set_status(&seat->fb, "Please wait...");
+            return;
+        }
+        begin_auth(seat);
+    }
+}
+
+static void handle_key(seat_t *seat, const key_event_t *key) {
+    // Handle Tab: toggle active field.
+    if (key->type == KEY_TAB) {
+        seat->editing_username = !seat->editing_username;
+        if (seat->editing_username) {
+            // A different username may follow, so the reader's verdict is moot.
+            cancel_auth(seat);
+            seat->fp_wanted = 0;
+            stop_fingerprint(seat);
+            ui_toast(&seat->fb, "Switched to Username Field", TOAST_MS / 2);
+        } else {
+            ui_toast(&seat->fb, "Switched to Password Field", TOAST_MS / 2);
+        }
+        return;
+    }
+
+    // Handle Ctrl-D: clear inputs and restart the prompt.
+    if (key->type == KEY_CTRL && key->code == 4) {
+        restart_prompt(seat, 500);
+        return;
+    }
+
+    // Ctrl-C and Ctrl-\ only arrive as keys in daemon mode, where the tty
+    // is not ours to take signals from; they mean what SIGINT does.
+    if (key->type == KEY_CTRL && (key->code == 3 || key->code == 28)) {
+        restart_prompt(seat, 1000);
+        return;
+    }
+
+    // Handle newline/Enter key.
+    if (key->type == KEY_ENTER) {
+        handle_enter(seat);
+        return;
+    }
+
+    // Escape backs out of a PAM prompt.
+    if (key->type == KEY_ESCAPE) {
+        cancel_auth(seat);
+        return;
+    }
+
+    // Everything else edits the active field.  A pause in typing the
+    // username starts looking it up in the background.
+    if (!seat->editing_username)
+        input_field_edit(&seat->password, key);
+    else if (input_field_edit(&seat->username, key))
+        event_timer_arm(seat->prefetch_src.fd, PREFETCH_PAUSE_MS);
 }
 
-void ignore_handler(int signum) {
-    (void)signum;
+/* Handle queued keys until they run out or one moves us off the fields,
+   then redraw once for the whole batch.  Keys left over wait for the next
+   time editing resumes. */
+static void process_keys(seat_t *seat) {
+    while (seat->key_next < seat->key_count) {
+        if (seat->state == STATE_AUTH) {
+            // While PAM works only Escape counts; other keys wait their turn.
+            int esc = seat->key_next;
+            while (esc < seat->key_count && seat->keys[esc].type != KEY_ESCAPE)
+                esc++;
+            if (esc == seat->key_count)
+                break;
+            seat->key_next = esc + 1;
+            cancel_auth(seat);
+            seat->state = STATE_EDITING;
+            continue;
+        }
+        if (seat->state != STATE_EDITING)
+            break;
+        handle_key(seat, &seat->keys[seat->key_next++]);
+    }
+    if (seat->key_next == seat->key_count)
+        seat->key_next = seat->key_count = 0;
+    if (seat->state == STATE_EDITING)
+        draw_login(seat);
 }
 
-/* Attempt fingerprint authentication.
-   Debug prints have been commented out. */
-int try_fingerprint(const char *username) {
-    char cmd[256];
-    snprintf(cmd, sizeof(cmd), "/usr/bin/fprintd-list %s 2>&1", username);
-    FILE *fp = popen(cmd, "r");
-    if (!fp) {
+/* Open a seat's framebuffer (again), honouring --no-vsync */
+static int open_fb(seat_t *seat) {
+    if (fb_init(&seat->fb, seat->fb_device) < 0) {
+        fprintf(stderr, "Failed to initialize framebuffer %s\n", seat->fb_device);
         return -1;
     }
-    char buffer[1024];
-    int enrolled = 0;
-    char finger[64] = {0};
-    while (fgets(buffer, sizeof(buffer), fp)) {
-        if (strstr(buffer, "- #")) {
-            char *colon = strchr(buffer, ':');
-            if (colon) {
-                colon++;
-                while (*colon == ' ')
-                    colon++;
-                strncpy(finger, colon, sizeof(finger) - 1);
-                finger[sizeof(finger) - 1] = '\0';
-                char *newline = strchr(finger, '\n');
-                if (newline)
-                    *newline = '\0';
+    if (!use_vsync)
+        seat->fb.vsync = 0;
+    return 0;
+}
+
+/* Take the display back from a session.  The mapping, glyph atlas and
+   background layer stayed warm; only a mode change made meanwhile means
+   starting over.  Returns -1, with the seat out of service, on failure. */
+static int reclaim_fb(seat_t *seat) {
+    if (fb_acquire(&seat->fb) == 0)
+        return 0;
+    fb_close(&seat->fb);
+    if (open_fb(seat) < 0) {
+        fprintf(stderr, "Seat %s is out of service\n", seat->tty);
+        seat->state = STATE_SESSION;
+        return -1;
+    }
+    return 0;
+}
+
+/* Open a daemon seat's terminal (again) and take its keyboard with signal
+   keys off, so they are read as keys.  A --seat tty is never our
+   controlling terminal, but with --resident the seat is our own /dev/tty1,
+   which is; resident mode relies on the session child taking it over with
+   TIOCSCTTY and force set (see spawn_session()). */
+static int open_tty(seat_t *seat) {
+    seat->tty_fd = open(seat->tty, O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (seat->tty_fd < 0) {
+        perror(seat->tty);
+        return -1;
+    }
+    if (input_init(&seat->input, seat->tty_fd, 0) < 0) {
+        close(seat->tty_fd);
+        seat->tty_fd = -1;
+        return -1;
+    }
+    seat->input_src.fd = seat->tty_fd;
+    if (event_add(&loop, &seat->input_src, EPOLLIN) < 0) {
+        input_restore(&seat->input);
+        close(seat->tty_fd);
+        seat->tty_fd = -1;
+        return -1;
+    }
+    tty_write(seat, "\e[?25l");
+    return 0;
+}
+
+static void close_tty(seat_t *seat) {
+    if (seat->tty_fd < 0)
+        return;
+    if (seat->input_src.fd >= 0)
+        event_remove(&loop, &seat->input_src);
+    seat->input_src.fd = -1;
+    input_restore(&seat->input);
+    close(seat->tty_fd);
+    seat->tty_fd = -1;
+}
+
+/* Put a fresh prompt on a daemon seat, e.g. after its session ended.  A
+   tty that cannot be reopened leaves the seat out of service. */
+static void reopen_seat(seat_t *seat) {
+    close_tty(seat);
+    seat->state = STATE_EDITING;
+    seat->key_next = seat->key_count = 0;
+    reset_prompt(seat);
+    if (open_tty(seat) < 0) {
+        fprintf(stderr, "Seat %s is out of service\n", seat->tty);
+        seat->state = STATE_SESSION;
+        return;
+    }
+    ui_invalidate(&seat->fb);
+    resume_editing(seat);
+}
+
+static void on_input(event_source_t *src, uint32_t events) {
+    seat_t *seat = src->data;
+    if (events & (EPOLLHUP | EPOLLERR)) {
+        if (!daemon_mode)
+            restore_and_exit(EXIT_FAILURE);
+        reopen_seat(seat);
+        return;
+    }
+    if (seat->state != STATE_EDITING && seat->state != STATE_AUTH)
+        return;
+    if (seat->key_count == MAX_KEYS) {
+        event_modify(&loop, src, 0);     // resume_editing() turns it back on
+        return;
+    }
+    int n = input_read(&seat->input, seat->keys + seat->key_count, MAX_KEYS - seat->key_count);
+    if (n < 0) {
+        if (!daemon_mode)
+            restore_and_exit(EXIT_FAILURE);
+        reopen_seat(seat);
+        return;
+    }
+    seat->key_count += n;
+    process_keys(seat);
+}
+
+/* Daemon mode: the session on a seat has ended.  Take the tty back and
+   put the prompt up again. */
+static void check_session(seat_t *seat) {
+    if (seat->session_pid <= 0 || waitpid(seat->session_pid, NULL, WNOHANG) != seat->session_pid)
+        return;
+    seat->session_pid = 0;
+    if (seat->session_src.fd >= 0) {
+        event_remove(&loop, &seat->session_src);
+        close(seat->session_src.fd);
+        seat->session_src.fd = -1;
+    }
+    if (seat->input.is_tty && (chown(seat->tty, 0, 0) < 0 || chmod(seat->tty, 0600) < 0))
+        perror("reclaim tty");
+    if (reclaim_fb(seat) == 0)
+        reopen_seat(seat);
+}
+
+static void on_signal(event_source_t *src, uint32_t events) {
+    (void)events;
+    struct signalfd_siginfo si;
+    while (read(src->fd, &si, sizeof(si)) == sizeof(si)) {
+        switch (si.ssi_signo) {
+        case SIGINT:
+        case SIGQUIT:
+            for (int i = 0; i < seat_count; i++)
+                restart_prompt(&seats[i], 1000);
+            break;
+        case SIGTERM:
+        case SIGHUP:
+            for (int i = 0; i < seat_count; i++)
+                stop_fingerprint(&seats[i]);
+            restore_and_exit(EXIT_SUCCESS);
+            break;
+        case SIGUSR1:
+            trace_dump();
+            break;
+        case SIGCHLD:
+            for (int i = 0; i < seat_count; i++) {
+                check_fingerprint(&seats[i]);
+                check_session(&seats[i]);
             }
-            enrolled = 1;
             break;
+        default:
+            break;      // SIGTSTP: ignored
         }
     }
-    pclose(fp);
-    if (!enrolled) {
+}
+
+static void on_fingerprint_exit(event_source_t *src, uint32_t events) {
+    (void)events;
+    check_fingerprint(src->data);
+}
+
+static void on_session_exit(event_source_t *src, uint32_t events) {
+    (void)events;
+    check_session(src->data);
+}
+
+static void on_fprint_change(event_source_t *src, uint32_t events) {
+    (void)src;
+    (void)events;
+    fprint_handle_events();
+}
+
+static void on_prefetch_timer(event_source_t *src, uint32_t events) {
+    seat_t *seat = src->data;
+    (void)events;
+    event_timer_ack(src->fd);
+    if (seat->editing_username)
+        account_request(seat->slot, seat->username.text);
+}
+
+/* A background lookup finished; start the reader on every seat where
+   Enter was waiting on it */
+static void on_account_ready(event_source_t *src, uint32_t events) {
+    (void)src;
+    (void)events;
+    account_handle_events();
+    /* The first wake-up is the worker finishing its warm-up */
+    if (trace_mark(TRACE_MARK_WARM))
+        trace_dump();
+    for (int i = 0; i < seat_count; i++) {
+        seat_t *seat = &seats[i];
+        if (start_wanted_fingerprint(seat) == 0 && seat->state == STATE_EDITING)
+            draw_login(seat);
+    }
+}
+
+/* Messages, prompts and the verdict from the PAM worker */
+static void on_auth_event(event_source_t *src, uint32_t events) {
+    seat_t *seat = src->data;
+    (void)events;
+    auth_event_t ev;
+    while (auth_next(&seat->auth, &ev)) {
+        switch (ev.type) {
+        case AUTH_INFO:
+        case AUTH_ERROR:
+            snprintf(seat->auth_note, sizeof(seat->auth_note), "%s", ev.text);
+            if (seat->state == STATE_AUTH)
+                set_auth_status(seat);
+            else
+                ui_set_status(&seat->fb, ev.text);
+            if (seat->state == STATE_AUTH || seat->state == STATE_EDITING)
+                draw_login(seat);
+            break;
+        case AUTH_PROMPT:
+            // The password field takes the answer; Enter sends it back.
+            event_timer_arm(seat->spin_src.fd, -1);
+            seat->auth_prompt = 1;
+            seat->editing_username = 0;
+            input_field_clear(&seat->password);
+            ui_set_status(&seat->fb, ev.text);
+            resume_editing(seat);
+            break;
+        case AUTH_DONE:
+            finish_auth(seat, ev.result, ev.delay_ms);
+            break;
+        }
+    }
+}
+
+static void on_spin_timer(event_source_t *src, uint32_t events) {
+    seat_t *seat = src->data;
+    (void)events;
+    event_timer_ack(src->fd);
+    if (seat->state != STATE_AUTH)
+        return;
+    seat->spin_frame++;
+    set_auth_status(seat);
+    draw_login(seat);
+    event_timer_arm(src->fd, SPINNER_MS);
+}
+
+/* The failure delay is over: send a password that was waiting on it */
+static void on_lockout_timer(event_source_t *src, uint32_t events) {
+    seat_t *seat = src->data;
+    (void)events;
+    event_timer_ack(src->fd);
+    seat->locked = 0;
+    if (!seat->submit_pending)
+        return;
+    seat->submit_pending = 0;
+    ui_set_status(&seat->fb, fingerprint_running(seat) ? FINGERPRINT_HINT : NULL);
+    if (seat->state == STATE_EDITING && !seat->editing_username) {
+        handle_enter(seat);
+        if (seat->state == STATE_EDITING)
+            draw_login(seat);
+    }
+}
+
+static void spawn_session(seat_t *seat);
+
+static void on_hold_timer(event_source_t *src, uint32_t events) {
+    seat_t *seat = src->data;
+    (void)events;
+    event_timer_ack(src->fd);
+    if (seat->state != STATE_HOLD)
+        return;
+    if (daemon_mode)
+        spawn_session(seat);
+    else
+        seat->session_ready = 1;    // the main loop leaves and starts the shell
+}
+
+static void on_anim_timer(event_source_t *src, uint32_t events) {
+    (void)events;
+    event_timer_ack(src->fd);
+}
+
+/* A session ready to exec, worked out before any fork(): the child of a
+   process with live threads (PAM, account and fprint workers) may only
+   make async-signal-safe calls, so no malloc, stdio or NSS after it. */
+typedef struct {
+    uid_t uid;
+    gid_t gid;
+    gid_t groups[ACCOUNT_MAX_GROUPS];
+    int ngroups;
+    int is_tty;                 /* stdin is a terminal to hand over */
+    char dir[256];
+    char shell[256];
+    char *argv[3];
+    char **envp;                /* our environment with env[] replacing */
+    char env[4][300];           /* HOME, USER, LOGNAME, SHELL */
+} session_t;
+
+extern char **environ;
+
+/* Internal: Is an environment entry one the session sets itself? */
+static int session_env_replaced(const char *entry) {
+    static const char *const names[] = { "HOME=", "USER=", "LOGNAME=", "SHELL=" };
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+        if (strncmp(entry, names[i], strlen(names[i])) == 0)
+            return 1;
+    return 0;
+}
+
+/* Resolve everything exec_session() needs for an account.  Returns 0, or
+   -1 if the session cannot be started; release it with session_free(). */
+static int session_prepare(const account_t *acct, int is_tty, session_t *sess) {
+    memset(sess, 0, sizeof(*sess));
+    if (acct->ngroups < 0) {
+        fprintf(stderr, "Cannot resolve the groups of %s\n", acct->user);
+        return -1;
+    }
+    sess->uid = acct->uid;
+    sess->gid = acct->gid;
+    sess->ngroups = acct->ngroups;
+    memcpy(sess->groups, acct->groups, sizeof(gid_t) * acct->ngroups);
+    sess->is_tty = is_tty;
+    snprintf(sess->dir, sizeof(sess->dir), "%s", acct->dir);
+    snprintf(sess->shell, sizeof(sess->shell), "%s", acct->shell[0] ? acct->shell : "/bin/sh");
+    sess->argv[0] = sess->shell;
+    sess->argv[1] = "--login";
+    sess->argv[2] = NULL;
+
+    snprintf(sess->env[0], sizeof(sess->env[0]), "HOME=%s", acct->dir);
+    snprintf(sess->env[1], sizeof(sess->env[1]), "USER=%s", acct->user);
+    snprintf(sess->env[2], sizeof(sess->env[2]), "LOGNAME=%s", acct->user);
+    snprintf(sess->env[3], sizeof(sess->env[3]), "SHELL=%s", sess->shell);
+    size_t count = 0;
+    while (environ[count])
+        count++;
+    sess->envp = malloc((count + 5) * sizeof(char *));
+    if (!sess->envp) {
+        perror("malloc");
         return -1;
     }
-    ui_draw_message(&fb, "Place your finger on the sensor");
-    sleep(1);
+    size_t n = 0;
+    for (size_t i = 0; i < count; i++)
+        if (!session_env_replaced(environ[i]))
+            sess->envp[n++] = environ[i];
+    for (int i = 0; i < 4; i++)
+        sess->envp[n++] = sess->env[i];
+    sess->envp[n] = NULL;
+    return 0;
+}
+
+static void session_free(session_t *sess) {
+    free(sess->envp);
+    sess->envp = NULL;
+}
+
+/* Internal: Report a failed step of exec_session() without stdio */
+static void session_error(const char *what) {
+    static const char prefix[] = "fblogin: ", suffix[] = " failed\n";
+    if (write(STDERR_FILENO, prefix, sizeof(prefix) - 1) < 0 ||
+        write(STDERR_FILENO, what, strlen(what)) < 0 ||
+        write(STDERR_FILENO, suffix, sizeof(suffix) - 1) < 0)
+        return;
+}
+
+/* Fix tty ownership, drop privileges and exec the user's login shell on
+   the terminal that is now stdin.  Only async-signal-safe calls, as it
+   may run in a freshly forked child, and failures leave with _exit() so
+   stdio buffers and atexit handlers inherited from a resident parent are
+   not run a second time.  Does not return. */
+static void exec_session(const session_t *sess) {
+    if (sess->is_tty) {
+        if (fchown(STDIN_FILENO, sess->uid, sess->gid) != 0)
+            session_error("chown tty");
+        if (fchmod(STDIN_FILENO, 0620) != 0)
+            session_error("chmod tty");
+    }
+
+    if (chdir(sess->dir) < 0)
+        session_error("chdir");
+
+    if (setgroups(sess->ngroups, sess->groups) < 0) {
+        session_error("setgroups");
+        _exit(EXIT_FAILURE);
+    }
+    if (setgid(sess->gid) < 0) {
+        session_error("setgid");
+        _exit(EXIT_FAILURE);
+    }
+    if (setuid(sess->uid) < 0) {
+        session_error("setuid");
+        _exit(EXIT_FAILURE);
+    }
+
+    execve(sess->shell, sess->argv, sess->envp);
+    session_error("execve");
+    _exit(EXIT_FAILURE);
+}
+
+/* The account to start a session for, looked up again now that PAM has
+   accepted the user: credentials, groups and shell must not come from a
+   cached entry that may predate a change.  The background lookup while
+   the user typed has warmed NSS, so this is normally quick. */
+static int session_account(const char *username, account_t *acct) {
+    return account_resolve(username, acct);
+}
+
+/* Tear everything down and become the user's login shell */
+static void start_session(seat_t *seat) {
+    account_t acct;
+    session_t sess;
+    if (session_account(seat->username.text, &acct) < 0 ||
+        session_prepare(&acct, seat->input.is_tty, &sess) < 0) {
+        restore_and_exit(EXIT_FAILURE);
+    }
+
+    fb_clear(&seat->fb, 0x000000);
+    fb_present(&seat->fb);
+    tty_write(seat, "\e[?25h");
+    input_restore(&seat->input);
+    fb_close(&seat->fb);
+    trace_dump();
+    account_close();
+    fprint_close();
+    event_loop_close(&loop);
+    sigprocmask(SIG_SETMASK, &orig_sigmask, NULL);
+    exec_session(&sess);
+}
+
+/* Daemon mode: run the session in a child that takes the seat's tty as
+   its controlling terminal, and leave the screen to it until it exits.
+   Everything the child needs is prepared first; after fork() it only
+   makes async-signal-safe calls. */
+static void spawn_session(seat_t *seat) {
+    account_t acct;
+    session_t sess;
+    if (session_account(seat->username.text, &acct) < 0 ||
+        session_prepare(&acct, seat->input.is_tty, &sess) < 0) {
+        reset_prompt(seat);
+        ui_toast(&seat->fb, acct.found ? "Cannot start a session." : "Unknown user.", TOAST_MS);
+        resume_editing(seat);
+        return;
+    }
+    fb_clear(&seat->fb, 0x000000);
+    fb_present(&seat->fb);
+    fb_release(&seat->fb);
+    tty_write(seat, "\e[?25h");
+    input_restore(&seat->input);
+    /* Paused is not enough: a hangup would still be reported */
+    event_remove(&loop, &seat->input_src);
+    seat->input_src.fd = -1;
+
     pid_t pid = fork();
+    if (pid == 0) {
+        sigprocmask(SIG_SETMASK, &orig_sigmask, NULL);
+        setsid();
+        if (seat->input.is_tty && ioctl(seat->tty_fd, TIOCSCTTY, 1) < 0)
+            session_error("TIOCSCTTY");
+        dup2(seat->tty_fd, STDIN_FILENO);
+        dup2(seat->tty_fd, STDOUT_FILENO);
+        dup2(seat->tty_fd, STDERR_FILENO);
+        exec_session(&sess);
+    }
+    session_free(&sess);
+    seat->state = STATE_SESSION;
+    input_field_clear(&seat->password);
     if (pid < 0) {
+        perror("fork");
+        if (reclaim_fb(seat) == 0)
+            reopen_seat(seat);
+        return;
+    }
+    seat->session_pid = pid;
+    /* Without pidfd support the exit is picked up from SIGCHLD instead */
+    seat->session_src.fd = event_pidfd_open(pid);
+    if (seat->session_src.fd >= 0 && event_add(&loop, &seat->session_src, EPOLLIN) < 0) {
+        close(seat->session_src.fd);
+        seat->session_src.fd = -1;
+    }
+}
+
+/* Register a seat's terminal, timers and PAM worker with the event loop */
+static int setup_seat(seat_t *seat) {
+    seat->input_src = (event_source_t){ seat->tty_fd, on_input, seat };
+    seat->hold_src = (event_source_t){ event_timer_open(), on_hold_timer, seat };
+    seat->fp_src = (event_source_t){ -1, on_fingerprint_exit, seat };
+    seat->prefetch_src = (event_source_t){ event_timer_open(), on_prefetch_timer, seat };
+    seat->auth_src = (event_source_t){ -1, on_auth_event, seat };
+    seat->spin_src = (event_source_t){ event_timer_open(), on_spin_timer, seat };
+    seat->lockout_src = (event_source_t){ event_timer_open(), on_lockout_timer, seat };
+    seat->session_src = (event_source_t){ -1, on_session_exit, seat };
+    if (seat->hold_src.fd < 0 || seat->prefetch_src.fd < 0 || seat->spin_src.fd < 0 ||
+        seat->lockout_src.fd < 0)
         return -1;
-    } else if (pid == 0) {
-        execl("/usr/bin/fprintd-verify", "fprintd-verify", "-f", finger, username, (char*)NULL);
-        exit(1);
-    } else {
-        int status;
-        waitpid(pid, &status, 0);
-        if (WIFEXITED(status))
-            return WEXITSTATUS(status);
+    if (event_add(&loop, &seat->hold_src, EPOLLIN) < 0 ||
+        event_add(&loop, &seat->prefetch_src, EPOLLIN) < 0 ||
+        event_add(&loop, &seat->spin_src, EPOLLIN) < 0 ||
+        event_add(&loop, &seat->lockout_src, EPOLLIN) < 0)
+        return -1;
+    if (daemon_mode) {
+        if (open_tty(seat) < 0)
+            return -1;
+    } else if (event_add(&loop, &seat->input_src, EPOLLIN) < 0) {
         return -1;
     }
+    /* Without it, logins on this seat are refused with a toast */
+    if (auth_init(&seat->auth, seat->tty) == 0) {
+        seat->auth_src.fd = auth_fd(&seat->auth);
+        if (event_add(&loop, &seat->auth_src, EPOLLIN) < 0)
+            return -1;
+        seat->auth_async = 1;
+    }
+    return 0;
+}
+
+/* Register signals, timers and every seat with the event loop */
+static int setup_events(void) {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGQUIT);
+    sigaddset(&mask, SIGTSTP);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGHUP);
+    sigaddset(&mask, SIGUSR1);
+    sigaddset(&mask, SIGCHLD);
+
+    if (event_loop_init(&loop) < 0)
+        return -1;
+    signal_src.fd = event_signal_open(&mask, &orig_sigmask);
+    anim_src.fd = event_timer_open();
+    if (signal_src.fd < 0 || anim_src.fd < 0)
+        return -1;
+    if (event_add(&loop, &signal_src, EPOLLIN) < 0 ||
+        event_add(&loop, &anim_src, EPOLLIN) < 0)
+        return -1;
+    for (int i = 0; i < seat_count; i++) {
+        if (setup_seat(&seats[i]) < 0) {
+            fprintf(stderr, "Failed to set up seat %s\n", seats[i].tty);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Start the helpers the first frame does not need.  Called once the
+   prompt is up, so thread start-up and the NSS and fprintd warm-up they
+   kick off stay off the time to first frame. */
+static int setup_workers(void) {
+    /* Without inotify the enrollment cache falls back to its TTL */
+    if (fprint_init() == 0) {
+        fprint_src.fd = fprint_fd();
+        if (event_add(&loop, &fprint_src, EPOLLIN) < 0)
+            return -1;
+    }
+    /* Started last: the worker thread inherits the blocked signal mask.
+       Without it, lookups simply happen on demand. */
+    if (account_init() == 0) {
+        account_src.fd = account_fd();
+        if (event_add(&loop, &account_src, EPOLLIN) < 0)
+            return -1;
+    }
+    trace_mark(TRACE_MARK_WORKERS);
+    return 0;
+}
+
+/* Parse "TTY[:FB]" into a new seat; the framebuffer defaults to fb_device */
+static int add_seat(const char *spec, const char *fb_device) {
+    if (seat_count == MAX_SEATS) {
+        fprintf(stderr, "At most %d seats are supported\n", MAX_SEATS);
+        return -1;
+    }
+    seat_t *seat = &seats[seat_count];
+    const char *colon = strchr(spec, ':');
+    size_t tty_len = colon ? (size_t)(colon - spec) : strlen(spec);
+    if (tty_len == 0 || tty_len >= sizeof(seat->tty)) {
+        fprintf(stderr, "Bad seat: %s\n", spec);
+        return -1;
+    }
+    memcpy(seat->tty, spec, tty_len);
+    seat->tty[tty_len] = '\0';
+    snprintf(seat->fb_device, sizeof(seat->fb_device), "%s", colon ? colon + 1 : fb_device);
+    seat->tty_fd = -1;
+    seat->slot = seat_count++;
+    return 0;
 }
 
 int main(int argc, char **argv) {
     int use_cmatrix = 0;
+    int resident = 0;
+    const char *fb_device = "/dev/fb0";
+    const char *seat_specs[MAX_SEATS + 1];
+    int seat_spec_count = 0;
     for (int i = 1; i < argc; i++) {
         if (strcmp(argv[i], "--cmatrix") == 0) {
             use_cmatrix = 1;
+        } else if (strcmp(argv[i], "--no-vsync") == 0) {
+            use_vsync = 0;
+        } else if (strcmp(argv[i], "--trace") == 0) {
+            trace_enable("/run/fblogin.trace");
+        } else if (strncmp(argv[i], "--trace=", 8) == 0) {
+            trace_enable(argv[i] + 8);
+        } else if (strcmp(argv[i], "--resident") == 0) {
+            resident = 1;
+        } else if (strcmp(argv[i], "--fb") == 0 && i + 1 < argc) {
+            fb_device = argv[++i];
+        } else if (strcmp(argv[i], "--wallpaper") == 0 && i + 1 < argc) {
+            ui_set_wallpaper(argv[++i]);
+        } else if (strcmp(argv[i], "--seat") == 0 && i + 1 < argc) {
+            if (seat_spec_count <= MAX_SEATS)
+                seat_specs[seat_spec_count++] = argv[i + 1];
+            i++;
         } else if (strcmp(argv[i], "--version") == 0) {
             printf("fblogin version %s\n", FBLOGIN_VERSION);
             return 0;
         }
     }
     ui_set_cmatrix(use_cmatrix);
-    
-    // Optionally restrict to tty1:
-    char *tty = ttyname(STDIN_FILENO);
-    if (!tty) {
-        fprintf(stderr, "Unable to determine tty name. Exiting.\n");
-        exit(EXIT_FAILURE);
+    trace_mark(TRACE_MARK_MAIN);
+
+    char *tty = NULL;
+    if (seat_spec_count == 0) {
+        // Optionally restrict to tty1:
+        tty = ttyname(STDIN_FILENO);
+        if (!tty) {
+            fprintf(stderr, "Unable to determine tty name. Exiting.\n");
+            exit(EXIT_FAILURE);
+        }
+        if (strcmp(tty, "/dev/tty1") != 0) {
+            fprintf(stderr, "fblogin must run only on /dev/tty1. Detected tty: %s. Exiting.\n", tty);
+            exit(EXIT_FAILURE);
+        }
+        /* Resident, the console is served like a daemon seat: the session
+           is forked and the prompt returns, still warm, when it ends */
+        if (resident)
+            seat_specs[seat_spec_count++] = tty;
     }
-    if (strcmp(tty, "/dev/tty1") != 0) {
-        fprintf(stderr, "fblogin must run only on /dev/tty1. Detected tty: %s. Exiting.\n", tty);
-        exit(EXIT_FAILURE);
+
+    daemon_mode = seat_spec_count > 0;
+    if (daemon_mode) {
+        for (int i = 0; i < seat_spec_count; i++)
+            if (add_seat(seat_specs[i], fb_device) < 0)
+                exit(EXIT_FAILURE);
+    } else {
+        add_seat(tty, fb_device);
+        seats[0].tty_fd = STDIN_FILENO;
     }
-    
+
     if(getuid() != 0) {
         fprintf(stderr, "This program must be run as root\n");
         exit(EXIT_FAILURE);
     }
-    
-    if (fb_init(&fb, "/dev/fb0") < 0) {
-        fprintf(stderr, "Failed to initialize framebuffer\n");
-        exit(EXIT_FAILURE);
+
+    for (int i = 0; i < seat_count; i++) {
+        if (open_fb(&seats[i]) < 0) {
+            seat_count = i;
+            restore_and_exit(EXIT_FAILURE);
+        }
     }
-    
-    if (input_init() < 0) {
+    trace_mark(TRACE_MARK_FB);
+
+    if (!daemon_mode && input_init(&seats[0].input, STDIN_FILENO, 1) < 0) {
         fprintf(stderr, "Failed to initialize input\n");
-        fb_close(&fb);
+        fb_close(&seats[0].fb);
         exit(EXIT_FAILURE);
     }
-    
-    printf("\e[?25l");
-    fflush(stdout);
-    
-    signal(SIGINT, restart_handler);
-    signal(SIGQUIT, restart_handler);
-    signal(SIGTSTP, ignore_handler);
-    
-    /* Outer loop: each iteration represents one full login attempt */
-    while (1) {
-        char username[MAX_INPUT] = {0};
-        char password[MAX_INPUT] = {0};
-        int pos_username = 0;
-        int pos_password = 0;
-        int auth_success = 0;
-        int in_password_phase = 0;     // 0 means still editing username; 1 means editing password.
-        int editing_username = 1;        // same as in_password_phase==0, but we keep it for clarity.
-        int attempted_fingerprint = 0;   // track if fingerprint auth was attempted
-        
-        /* Unified input loop for both username and password.
-           The UI redraws both fields each iteration, and Tab toggles which field is active. */
-        while (!auth_success) {
-            if (restart_requested) {
-                memset(username, 0, sizeof(username));
-                memset(password, 0, sizeof(password));
-                pos_username = pos_password = 0;
-                restart_requested = 0;
-                ui_draw_error(&fb, "Restarting login prompt...");
-                sleep(1);
-                continue;
-            }
-            
-            // Redraw the UI with both fields. When still in username phase, password may be empty.
-            ui_draw_login(&fb, username, password);
-            int c = input_getchar();
-            
-            // Handle Tab: toggle active field.
-            if (c == '\t' || c == 9) {
-                editing_username = !editing_username;
-                if (editing_username)
-                    ui_draw_error(&fb, "Switched to Username Field");
-                else
-                    ui_draw_error(&fb, "Switched to Password Field");
-                continue;
-            }
-            
-            // Handle Ctrl-D: clear inputs and restart this outer iteration.
-            if (c == 4) {
-                memset(username, 0, sizeof(username));
-                memset(password, 0, sizeof(password));
-                pos_username = pos_password = 0;
-                ui_draw_error(&fb, "Restarting login prompt...");
-                sleep(0.5);
-                break;  // Break out of the inner loop to restart the outer loop.
-            }
-            
-            // Handle newline/Enter key.
-            if (c == '\n' || c == '\r') {
-                if (editing_username) {
-                    // If editing username and it is nonempty, finish username phase.
-                    if (pos_username > 0) {
-                        // Optionally, if fingerprint auth is available, try it once.
-                        if (is_fprintd_available() && !attempted_fingerprint) {
-                            int fp_ret = try_fingerprint(username);
-                            attempted_fingerprint = 1;
-                            if (fp_ret == 0) {
-                                auth_success = 1;
-                                break;
-                            } else {
-                                ui_draw_error(&fb, "Fingerprint auth failed, fallback to password");
-                                sleep(2);
-                            }
-                        }
-                        // Switch to password phase.
-                        editing_username = 0;
-                        in_password_phase = 1;
-                    }
-                } else {
-                    // If editing password and password is nonempty, try authentication.
-                    if (pos_password > 0) {
-                        int ret = authenticate_user(username, password);
-                        if (ret == 0) {
-                            auth_success = 1;
-                            break;
-                        } else {
-                            ui_draw_error(&fb, "Authentication failed. Try again.");
-                            sleep(2);
-                            memset(password, 0, sizeof(password));
-                            pos_password = 0;
-                        }
-                    }
-                }
-                continue;
-            }
-            
-            // Handle backspace.
-            if (c == 127 || c == 8) {
-                if (editing_username) {
-                    if (pos_username > 0)
-                        username[--pos_username] = '\0';
-                } else {
-                    if (pos_password > 0)
-                        password[--pos_password] = '\0';
-                }
-                continue;
-            }
-            
-            // Handle printable characters.
-            if (c >= 32 && c <= 126) {
-                if (editing_username) {
-                    if (pos_username < MAX_INPUT - 1) {
-                        username[pos_username++] = (char)c;
-                        username[pos_username] = '\0';
-                    }
-                } else {
-                    if (pos_password < MAX_INPUT - 1) {
-                        password[pos_password++] = (char)c;
-                        password[pos_password] = '\0';
-                    }
-                }
+
+    if (setup_events() < 0) {
+        fprintf(stderr, "Failed to set up the event loop\n");
+        restore_and_exit(EXIT_FAILURE);
+    }
+    trace_mark(TRACE_MARK_LOOP);
+
+    /* The first frame is plain: the background is composed on the first
+       tick below, once the workers are already on their way */
+    for (int i = 0; i < seat_count; i++) {
+        if (!daemon_mode)
+            tty_write(&seats[i], "\e[?25l");
+        reset_prompt(&seats[i]);
+        resume_editing(&seats[i]);
+    }
+    trace_mark(TRACE_MARK_FIRST_FRAME);
+    if (setup_workers() < 0) {
+        fprintf(stderr, "Failed to set up the event loop\n");
+        restore_and_exit(EXIT_FAILURE);
+    }
+
+    /* Each pass runs whatever is due on the seats, re-arms the animation
+       timer for the next frame due on any seat (or disarms it when nothing
+       animates), then handles whatever is ready.  In daemon mode it runs
+       until SIGTERM. */
+    while (daemon_mode || !seats[0].session_ready) {
+        int wait = -1;
+        for (int i = 0; i < seat_count; i++) {
+            if (seats[i].state == STATE_SESSION)
                 continue;
-            }
-        } // End of unified input loop.
-        
-        // If we broke out of the input loop without successful auth (e.g. due to Ctrl-D), restart.
-        if (!auth_success)
-            continue;
-        
-        /* Authentication was successful; proceed with login. */
-        struct passwd *pw = getpwnam(username);
-        if (!pw) {
-            restore_and_exit(EXIT_FAILURE);
-        }
-        
-        ui_draw_welcome(&fb, username);
-        sleep(2);
-        
-        fb_clear(&fb, 0x000000);
-        printf("\e[?25h");
-        fflush(stdout);
-        input_restore();
-        fb_close(&fb);
-        
-        /* --- fix tty ownership and permissions --- */
-        {
-            char *tty = ttyname(STDIN_FILENO);
-            if (tty != NULL) {
-                if (chown(tty, pw->pw_uid, pw->pw_gid) != 0) {
-                    perror("chown tty");
-                }
-                if (chmod(tty, 0620) != 0) {
-                    perror("chmod tty");
-                }
-            }
-        }
-        
-        setenv("HOME", pw->pw_dir, 1);
-        setenv("USER", pw->pw_name, 1);
-        setenv("LOGNAME", pw->pw_name, 1);
-        setenv("SHELL", pw->pw_shell, 1);
-        
-        if(chdir(pw->pw_dir) < 0)
-            perror("chdir");
-        
-        if(initgroups(username, pw->pw_gid) < 0) {
-            perror("initgroups");
-            exit(EXIT_FAILURE);
-        }
-        if(setgid(pw->pw_gid) < 0) {
-            perror("setgid");
-            exit(EXIT_FAILURE);
+            int due = ui_tick(&seats[i].fb);
+            if (due >= 0 && (wait < 0 || due < wait))
+                wait = due;
         }
-        if(setuid(pw->pw_uid) < 0) {
-            perror("setuid");
-            exit(EXIT_FAILURE);
-        }
-        
-        setsid();
-        
-        char *shell = pw->pw_shell;
-        if(!shell || shell[0] == '\0')
-            shell = "/bin/sh";
-        
-        char *const args[] = { shell, "--login", NULL };
-        execv(shell, args);
-        perror("execv");
-        exit(EXIT_FAILURE);
-    } // End of outer loop.
+        event_timer_arm(anim_src.fd, wait);
+        if (event_dispatch(&loop, -1) < 0)
+            restore_and_exit(EXIT_FAILURE);
+    }
+    start_session(&seats[0]);
+    return EXIT_FAILURE;
 }
-
@@ -1,67 +1,300 @@
 #include "pam_auth.h"
 #include <security/pam_appl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
 
-static int pam_conv_func(int num_msg, const struct pam_message **msg,
-                         struct pam_response **resp, void *appdata_ptr) {
+#define AUTH_QUEUE 8
+#define AUTH_FAIL_DELAY_US 2000000  /* minimum delay after a failure */
+#define AUTH_PROMPT_TIMEOUT_S 120   /* an unanswered prompt fails the attempt */
+
+/* PAM modules are not all thread-safe (pam_unix uses getpwnam()'s static
+   buffers, pam_faillock shares tally files), so only one seat's worker is
+   inside PAM at a time.  It is never held while waiting for a person. */
+static pthread_mutex_t auth_pam_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* One authentication attempt.  Both the UI (until it cancels or sees
+   AUTH_DONE) and the seat's worker hold a reference; an attempt cancelled
+   while inside a PAM module simply finishes unheard. */
+typedef struct auth_session {
+    int refs;
+    int cancelled;
+    int efd;                /* the owner's eventfd */
+    char tty[64];
+    char username[256];
+    char password[256];
+    int password_used;
+    char answer[256];
+    int answered;
+    int fail_delay_ms;
+    auth_event_t events[AUTH_QUEUE];
+    int head;
+    int count;
+} auth_session_t;
+
+/* One lock for every seat: it only ever guards a few field updates */
+static pthread_mutex_t auth_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t auth_cond = PTHREAD_COND_INITIALIZER;
+
+/* Internal: Drop a reference (lock held), wiping secrets with the last */
+static void auth_release(auth_session_t *s) {
+    if (--s->refs > 0)
+        return;
+    explicit_bzero(s, sizeof(*s));
+    free(s);
+}
+
+/* Internal: Queue an event for the UI unless it has stopped listening,
+   waiting for room while the queue is full so nothing is lost */
+static void auth_post(auth_session_t *s, auth_event_type_t type, int echo, int result, const char *text) {
+    pthread_mutex_lock(&auth_lock);
+    while (!s->cancelled && s->count == AUTH_QUEUE)
+        pthread_cond_wait(&auth_cond, &auth_lock);
+    if (!s->cancelled) {
+        auth_event_t *ev = &s->events[(s->head + s->count++) % AUTH_QUEUE];
+        ev->type = type;
+        ev->echo = echo;
+        ev->result = result;
+        ev->delay_ms = s->fail_delay_ms;
+        snprintf(ev->text, sizeof(ev->text), "%s", text ? text : "");
+    }
+    pthread_mutex_unlock(&auth_lock);
+    uint64_t one = 1;
+    if (write(s->efd, &one, sizeof(one)) < 0)
+        perror("write eventfd");
+}
+
+/* Internal: Conversation for the worker.  Messages are passed on to the
+   UI; prompts after the first hidden one wait for the user's answer. */
+static int auth_conv(int num_msg, const struct pam_message **msg,
+                     struct pam_response **resp, void *appdata_ptr) {
+    auth_session_t *s = appdata_ptr;
     if (num_msg <= 0)
         return PAM_CONV_ERR;
-    *resp = (struct pam_response *)calloc(num_msg, sizeof(struct pam_response));
+    *resp = calloc(num_msg, sizeof(struct pam_response));
     if (*resp == NULL)
         return PAM_BUF_ERR;
-    const char *password = (const char *)appdata_ptr;
     for (int i = 0; i < num_msg; i++) {
-        switch(msg[i]->msg_style) {
-            case PAM_PROMPT_ECHO_OFF:
-            case PAM_PROMPT_ECHO_ON:
-                (*resp)[i].resp = strdup(password);
-                (*resp)[i].resp_retcode = 0;
-                break;
-            case PAM_TEXT_INFO:
-            case PAM_ERROR_MSG:
-                (*resp)[i].resp = NULL;
-                break;
-            default:
-                free(*resp);
-                return PAM_CONV_ERR;
+        int style = msg[i]->msg_style;
+        if (style == PAM_TEXT_INFO || style == PAM_ERROR_MSG) {
+            auth_post(s, style == PAM_TEXT_INFO ? AUTH_INFO : AUTH_ERROR, 0, 0, msg[i]->msg);
+            continue;
+        }
+        if (style != PAM_PROMPT_ECHO_OFF && style != PAM_PROMPT_ECHO_ON)
+            goto fail;
+        if (style == PAM_PROMPT_ECHO_OFF && !s->password_used) {
+            s->password_used = 1;
+            (*resp)[i].resp = strdup(s->password);
+            continue;
+        }
+        /* Other seats may use PAM while this one waits for its user */
+        pthread_mutex_unlock(&auth_pam_lock);
+        auth_post(s, AUTH_PROMPT, style == PAM_PROMPT_ECHO_ON, 0, msg[i]->msg);
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += AUTH_PROMPT_TIMEOUT_S;
+        int err = 0;
+        pthread_mutex_lock(&auth_lock);
+        while (!s->answered && !s->cancelled && err != ETIMEDOUT)
+            err = pthread_cond_timedwait(&auth_cond, &auth_lock, &deadline);
+        if (!s->answered) {
+            pthread_mutex_unlock(&auth_lock);
+            pthread_mutex_lock(&auth_pam_lock);
+            goto fail;
         }
+        (*resp)[i].resp = strdup(s->answer);
+        explicit_bzero(s->answer, sizeof(s->answer));
+        s->answered = 0;
+        pthread_mutex_unlock(&auth_lock);
+        pthread_mutex_lock(&auth_pam_lock);
     }
     return PAM_SUCCESS;
+
+fail:
+    for (int i = 0; i < num_msg; i++) {
+        if ((*resp)[i].resp) {
+            explicit_bzero((*resp)[i].resp, strlen((*resp)[i].resp));
+            free((*resp)[i].resp);
+        }
+    }
+    free(*resp);
+    *resp = NULL;
+    return PAM_CONV_ERR;
+}
+
+/* Internal: PAM_FAIL_DELAY hook.  Instead of sleeping in the worker, the
+   delay PAM settled on travels with AUTH_DONE and the UI enforces it as a
+   lockout while the screen stays live. */
+static void auth_fail_delay(int retval, unsigned usec_delay, void *appdata_ptr) {
+    auth_session_t *s = appdata_ptr;
+    if (retval != PAM_SUCCESS)
+        s->fail_delay_ms = usec_delay / 1000;
 }
 
-int authenticate_user(const char *username, const char *password) {
+/* Internal: One PAM transaction, ending with AUTH_DONE.  The PAM lock is
+   held throughout, except while a prompt waits for an answer. */
+static void auth_run(auth_session_t *s) {
     pam_handle_t *pamh = NULL;
-    int retval;
-    struct pam_conv conv = {
-        .conv = pam_conv_func,
-        .appdata_ptr = (void *)password
-    };
-
-    /* Use the "fblogin" PAM service (ensure /etc/pam.d/fblogin exists) */
-    retval = pam_start("fblogin", username, &conv, &pamh);
-    if(retval != PAM_SUCCESS) {
-        fprintf(stderr, "pam_start failed: %s\n", pam_strerror(pamh, retval));
-        return -1;
+    struct pam_conv conv = { .conv = auth_conv, .appdata_ptr = s };
+    pthread_mutex_lock(&auth_pam_lock);
+    int retval = pam_start("fblogin", s->username, &conv, &pamh);
+    if (retval == PAM_SUCCESS) {
+        pam_set_item(pamh, PAM_TTY, s->tty);
+        pam_fail_delay(pamh, AUTH_FAIL_DELAY_US);
+        pam_set_item(pamh, PAM_FAIL_DELAY, (const void *)auth_fail_delay);
+        retval = pam_authenticate(pamh, 0);
+        if (retval == PAM_SUCCESS)
+            retval = pam_acct_mgmt(pamh, 0);
+        /* An expired password is changed right here, through the prompts */
+        if (retval == PAM_NEW_AUTHTOK_REQD)
+            retval = pam_chauthtok(pamh, PAM_CHANGE_EXPIRED_AUTHTOK);
     }
-    
-    /* Tell PAM which TTY we're using */
-    pam_set_item(pamh, PAM_TTY, "/dev/tty1");
-    
-    retval = pam_authenticate(pamh, 0);
-    if(retval != PAM_SUCCESS) {
+    char text[256];
+    snprintf(text, sizeof(text), "%s", pam_strerror(pamh, retval));
+    if (pamh)
         pam_end(pamh, retval);
+    pthread_mutex_unlock(&auth_pam_lock);
+    auth_post(s, AUTH_DONE, 0, retval == PAM_SUCCESS ? 0 : -1, text);
+}
+
+/* Internal: A seat's worker.  It runs the seat's attempts one at a time,
+   the latest replacing any still waiting, and exits when none is left. */
+static void *auth_worker(void *arg) {
+    auth_t *auth = arg;
+    pthread_mutex_lock(&auth_lock);
+    while (auth->queued) {
+        auth_session_t *s = auth->queued;
+        auth->queued = NULL;
+        if (!s->cancelled) {
+            pthread_mutex_unlock(&auth_lock);
+            auth_run(s);
+            pthread_mutex_lock(&auth_lock);
+        }
+        auth_release(s);
+    }
+    auth->worker_running = 0;
+    pthread_mutex_unlock(&auth_lock);
+    return NULL;
+}
+
+/* Public: Create the completion eventfd of a seat whose logins happen on
+   tty.  Returns 0, or -1 if asynchronous authentication is unavailable. */
+int auth_init(auth_t *auth, const char *tty) {
+    auth->current = NULL;
+    auth->queued = NULL;
+    auth->worker_running = 0;
+    snprintf(auth->tty, sizeof(auth->tty), "%s", tty);
+    auth->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (auth->efd < 0) {
+        perror("eventfd");
         return -1;
     }
-    
-    retval = pam_acct_mgmt(pamh, 0);
-    if(retval != PAM_SUCCESS) {
-        pam_end(pamh, retval);
+    return 0;
+}
+
+int auth_fd(const auth_t *auth) {
+    return auth->efd;
+}
+
+/* Public: Hand an attempt to the seat's worker thread, starting it if
+   needed, and replace (cancel) any attempt of this seat still in progress.
+   One abandoned inside PAM delays the new one until it returns, so a seat
+   never has more than one transaction or thread.  Returns 0, or -1 if it
+   could not start. */
+int auth_begin(auth_t *auth, const char *username, const char *password) {
+    if (auth->efd < 0)
         return -1;
+    auth_cancel(auth);
+    auth_session_t *s = calloc(1, sizeof(*s));
+    if (!s)
+        return -1;
+    s->refs = 2;
+    s->efd = auth->efd;
+    memcpy(s->tty, auth->tty, sizeof(s->tty));
+    snprintf(s->username, sizeof(s->username), "%s", username);
+    snprintf(s->password, sizeof(s->password), "%s", password);
+
+    pthread_mutex_lock(&auth_lock);
+    if (!auth->worker_running) {
+        pthread_t thread;
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        int err = pthread_create(&thread, &attr, auth_worker, auth);
+        pthread_attr_destroy(&attr);
+        if (err != 0) {
+            pthread_mutex_unlock(&auth_lock);
+            errno = err;
+            perror("pthread_create");
+            explicit_bzero(s, sizeof(*s));
+            free(s);
+            return -1;
+        }
+        auth->worker_running = 1;
     }
-    
-    pam_end(pamh, PAM_SUCCESS);
+    /* The worker cannot look before the lock is released; an attempt still
+       waiting was cancelled above and is dropped */
+    if (auth->queued)
+        auth_release(auth->queued);
+    auth->queued = s;
+    auth->current = s;
+    pthread_mutex_unlock(&auth_lock);
     return 0;
 }
 
+/* Public: Take the next event of the current attempt.  Returns 1 with ev
+   filled, or 0 if there is none. */
+int auth_next(auth_t *auth, auth_event_t *ev) {
+    uint64_t count;
+    if (read(auth->efd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        perror("read eventfd");
+    int got = 0;
+    pthread_mutex_lock(&auth_lock);
+    auth_session_t *s = auth->current;
+    if (s && s->count > 0) {
+        *ev = s->events[s->head];
+        s->head = (s->head + 1) % AUTH_QUEUE;
+        s->count--;
+        got = 1;
+        pthread_cond_broadcast(&auth_cond);     /* room for a waiting auth_post() */
+        if (ev->type == AUTH_DONE) {
+            auth->current = NULL;
+            auth_release(s);
+        }
+    }
+    pthread_mutex_unlock(&auth_lock);
+    return got;
+}
+
+/* Public: Answer the prompt the current attempt is waiting on */
+void auth_respond(auth_t *auth, const char *answer) {
+    pthread_mutex_lock(&auth_lock);
+    auth_session_t *s = auth->current;
+    if (s) {
+        snprintf(s->answer, sizeof(s->answer), "%s", answer);
+        s->answered = 1;
+        pthread_cond_broadcast(&auth_cond);
+    }
+    pthread_mutex_unlock(&auth_lock);
+}
+
+/* Public: Abandon the current attempt.  A worker waiting on a prompt gives
+   up at once; one busy inside PAM finishes on its own, unheard.  A prompt
+   nobody answers fails by itself after AUTH_PROMPT_TIMEOUT_S. */
+void auth_cancel(auth_t *auth) {
+    pthread_mutex_lock(&auth_lock);
+    auth_session_t *s = auth->current;
+    if (s) {
+        s->cancelled = 1;
+        pthread_cond_broadcast(&auth_cond);
+        auth->current = NULL;
+        auth_release(s);
+    }
+    pthread_mutex_unlock(&auth_lock);
+}
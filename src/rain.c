@@ -0,0 +1,121 @@
+#include "rain.h"
+#include <stdio.h>
+#include <string.h>
+
+static const char rain_charset[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+
+/* Head, then three trail shades from bright to dim */
+static const uint32_t rain_shades[4] = { 0x00AA00, 0x005500, 0x003300, 0x001100 };
+
+static uint32_t rain_next(rain_column_t *col) {
+    uint32_t x = col->rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return col->rng = x;
+}
+
+/* Internal: Start a new streak above the top of the screen */
+static void rain_spawn(rain_t *rain, rain_column_t *col) {
+    col->trail = 6 + rain_next(col) % (RAIN_MAX_TRAIL - 6);
+    col->speed = 1 + rain_next(col) % 3;
+    col->head = -1 - (int)(rain_next(col) % (unsigned)rain->rows);
+    col->wait = col->speed;
+}
+
+/* Internal: Shade for a glyph d cells behind the head */
+static uint32_t rain_shade(const rain_column_t *col, int d) {
+    if (d == 0)
+        return rain_shades[0];
+    return rain_shades[1 + (d - 1) * 3 / col->trail];
+}
+
+/* Internal: Replace a cell with a fresh random glyph */
+static void rain_draw_cell(rain_t *rain, framebuffer_t *view, int c, int row, uint32_t color) {
+    rain_column_t *col = &rain->columns[c];
+    if (row < 0 || row >= rain->rows)
+        return;
+    char text[2] = { rain_charset[rain_next(col) % (sizeof(rain_charset) - 1)], '\0' };
+    int x = c * rain->cell_w, y = row * rain->cell_h;
+    fb_draw_rect(view, x, y, rain->cell_w, rain->cell_h, 0x000000);
+    fb_draw_text(view, x, y, text, color);
+}
+
+/* Internal: Advance one column by one cell.  The streak moves as a block,
+   so every glyph keeps its shade; only the head (which changes glyph every
+   step), the cell entering at the top and the cell left behind at the
+   tail need drawing. */
+static void rain_step(rain_t *rain, framebuffer_t *view, int c) {
+    rain_column_t *col = &rain->columns[c];
+    int x = c * rain->cell_w, cell_h = rain->cell_h;
+
+    int top = col->head - col->trail + 1;
+    if (top < 0)
+        top = 0;
+    if (col->head >= 0 && top < rain->rows) {
+        int bottom = col->head < rain->rows ? col->head : rain->rows - 1;
+        fb_scroll_rect(view, x, top * cell_h, rain->cell_w, (bottom - top + 1) * cell_h, cell_h);
+    }
+    col->head++;
+    if (col->head >= 0 && top < rain->rows) {
+        int bottom = col->head < rain->rows ? col->head : rain->rows - 1;
+        fb_rect_t r = { x, top * cell_h, rain->cell_w, (bottom - top + 1) * cell_h };
+        rain->changed[rain->changed_count++] = r;
+    }
+    rain_draw_cell(rain, view, c, col->head, rain_shade(col, 0));
+
+    int tail = col->head - col->trail;
+    if (tail >= 0 && tail < rain->rows)
+        fb_draw_rect(view, x, tail * cell_h, rain->cell_w, cell_h, 0x000000);
+    else if (tail < 0 && col->head > 0)
+        rain_draw_cell(rain, view, c, 0, rain_shade(col, col->head));
+    if (tail >= rain->rows)
+        rain_spawn(rain, col);
+}
+
+void rain_free(rain_t *rain) {
+    free(rain->columns);
+    free(rain->changed);
+    rain->columns = NULL;
+    rain->changed = NULL;
+}
+
+/* Size the rain for a view and clear it; -1 on allocation failure */
+int rain_init(rain_t *rain, framebuffer_t *view, uint32_t seed) {
+    rain->cell_w = view->font->cell_w;
+    rain->cell_h = view->font->cell_h;
+    rain->cols = (view->width + rain->cell_w - 1) / rain->cell_w;
+    rain->rows = (view->height + rain->cell_h - 1) / rain->cell_h;
+    rain_column_t *columns = calloc(rain->cols, sizeof(*columns));
+    fb_rect_t *changed = calloc(rain->cols, sizeof(*changed));
+    if (!columns || !changed) {
+        perror("calloc rain");
+        free(columns);
+        free(changed);
+        return -1;
+    }
+    rain_free(rain);
+    rain->columns = columns;
+    rain->changed = changed;
+    for (int c = 0; c < rain->cols; c++) {
+        /* Distinct non-zero xorshift state per column */
+        columns[c].rng = (seed ^ (uint32_t)(c + 1) * 0x9E3779B9u) | 1;
+        rain_spawn(rain, &columns[c]);
+    }
+    fb_clear(view, 0x000000);
+    return 0;
+}
+
+/* Advance the rain by one frame.  The strip each moving column touched is
+   listed in rain->changed. */
+void rain_tick(rain_t *rain, framebuffer_t *view) {
+    rain->changed_count = 0;
+    for (int c = 0; c < rain->cols; c++) {
+        rain_column_t *col = &rain->columns[c];
+        if (--col->wait > 0)
+            continue;
+        col->wait = col->speed;
+        rain_step(rain, view, c);
+    }
+}
+
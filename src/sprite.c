@@ -0,0 +1,205 @@
+#include "sprite.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Sprites are mapped read-only and drawn straight from the mapping; the
+   only work at load time is checking that every offset and run stays
+   inside the file, so drawing needs no bounds checks. */
+
+static sprite_t *sprite_list;       /* open files, shared by path */
+
+/* Public: Check a sprite image in memory and describe it in sprite (the
+   data must be 4-aligned and outlive it).  Returns 0, or -1 if it is not
+   a valid sprite. */
+int sprite_from_memory(sprite_t *sprite, const void *data, size_t size) {
+    const uint8_t *bytes = data;
+    sprite_header_t h;
+    if (size < sizeof(h) || ((uintptr_t)data & 3))
+        return -1;
+    memcpy(&h, bytes, sizeof(h));
+    if (memcmp(h.magic, SPRITE_MAGIC, sizeof(h.magic)) != 0 || h.width == 0 || h.height == 0 ||
+        h.width > SPRITE_MAX_SIZE || h.height > SPRITE_MAX_SIZE || (h.flags & ~SPRITE_RLE))
+        return -1;
+    size_t table_end = sizeof(h) + (size_t)h.height * 4;
+    if (table_end > size)
+        return -1;
+    const uint32_t *rows = (const uint32_t *)(bytes + sizeof(h));
+    for (int r = 0; r < h.height; r++) {
+        size_t pos = rows[r];
+        if ((pos & 3) || pos < table_end || pos > size)
+            return -1;
+        if (!(h.flags & SPRITE_RLE)) {
+            if ((size - pos) / 4 < h.width)
+                return -1;
+            continue;
+        }
+        for (int x = 0; x < h.width;) {
+            if (size - pos < 4)
+                return -1;
+            uint32_t run;
+            memcpy(&run, bytes + pos, 4);
+            pos += 4;
+            int skip = run & 0xFFFF, count = run >> 16;
+            if (skip + count == 0 || skip + count > h.width - x || (size - pos) / 4 < (size_t)count)
+                return -1;
+            pos += (size_t)count * 4;
+            x += skip + count;
+        }
+    }
+    sprite->width = h.width;
+    sprite->height = h.height;
+    sprite->rle = (h.flags & SPRITE_RLE) != 0;
+    sprite->data = bytes;
+    sprite->size = size;
+    sprite->rows = rows;
+    return 0;
+}
+
+/* Public: Map a sprite file, or take another reference to it if it is
+   already open.  Returns NULL if it is missing or not a valid sprite. */
+sprite_t *sprite_open(const char *path) {
+    for (sprite_t *s = sprite_list; s; s = s->next) {
+        if (strcmp(s->path, path) == 0) {
+            s->refs++;
+            return s;
+        }
+    }
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno != ENOENT)
+            perror(path);
+        return NULL;
+    }
+    struct stat st;
+    sprite_t *sprite = calloc(1, sizeof(*sprite));
+    void *data = MAP_FAILED;
+    if (sprite && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        free(sprite);
+        return NULL;
+    }
+    if (sprite_from_memory(sprite, data, st.st_size) < 0) {
+        fprintf(stderr, "Invalid sprite %s\n", path);
+        munmap(data, st.st_size);
+        free(sprite);
+        return NULL;
+    }
+    snprintf(sprite->path, sizeof(sprite->path), "%s", path);
+    sprite->refs = 1;
+    sprite->mapped = 1;
+    sprite->next = sprite_list;
+    sprite_list = sprite;
+    return sprite;
+}
+
+/* Public: Drop a reference from sprite_open(), unmapping with the last */
+void sprite_close(sprite_t *sprite) {
+    if (!sprite || --sprite->refs > 0)
+        return;
+    for (sprite_t **p = &sprite_list; *p; p = &(*p)->next) {
+        if (*p == sprite) {
+            *p = sprite->next;
+            break;
+        }
+    }
+    if (sprite->mapped)
+        munmap((void *)sprite->data, sprite->size);
+    free(sprite);
+}
+
+/* Public: Composite a sprite with its top left corner at (x, y), clipped
+   to the screen and to clip if given.  Each run of a row is one
+   fb_blend_span(). */
+void sprite_draw(framebuffer_t *fb, const sprite_t *sprite, int x, int y, const fb_rect_t *clip) {
+    int x0 = x > 0 ? x : 0, y0 = y > 0 ? y : 0;
+    int x1 = x + sprite->width < fb->width ? x + sprite->width : fb->width;
+    int y1 = y + sprite->height < fb->height ? y + sprite->height : fb->height;
+    if (clip) {
+        if (clip->x > x0) x0 = clip->x;
+        if (clip->y > y0) y0 = clip->y;
+        if (clip->x + clip->w < x1) x1 = clip->x + clip->w;
+        if (clip->y + clip->h < y1) y1 = clip->y + clip->h;
+    }
+    if (x0 >= x1 || y0 >= y1)
+        return;
+
+    int bytes = fb->format.bytes_per_pixel;
+    int from = x0 - x, to = x1 - x;     /* sprite columns to draw */
+    for (int row = y0; row < y1; row++) {
+        const uint8_t *p = sprite->data + sprite->rows[row - y];
+        /* Screen column x0 is sprite column from; x itself may be off-screen */
+        uint8_t *line = fb->draw_ptr + (size_t)row * fb->stride + (size_t)x0 * bytes;
+        for (int sx = 0; sx < to;) {
+            int count = sprite->width;
+            if (sprite->rle) {
+                uint32_t run;
+                memcpy(&run, p, 4);
+                p += 4;
+                sx += run & 0xFFFF;
+                count = run >> 16;
+            }
+            int a = sx > from ? sx : from;
+            int b = sx + count < to ? sx + count : to;
+            if (a < b) {
+                fb_blend_span(fb, line + (size_t)(a - from) * bytes, (const uint32_t *)p + (a - sx), b - a);
+            }
+            p += (size_t)count * 4;
+            sx += count;
+        }
+    }
+    fb_damage(fb, x0, y0, x1 - x0, y1 - y0);
+}
+
+/* Public: Build a sprite file from straight (not premultiplied)
+   0xAARRGGBB pixels, run-length encoding transparent pixels if rle is set.
+   Returns its size with *out malloc'd, or 0 on failure. */
+size_t sprite_encode(const uint32_t *argb, int width, int height, int rle, uint8_t **out) {
+    if (width <= 0 || height <= 0 || width > SPRITE_MAX_SIZE || height > SPRITE_MAX_SIZE)
+        return 0;
+    size_t table_end = sizeof(sprite_header_t) + (size_t)height * 4;
+    /* Worst case for RLE: a run word per pixel */
+    size_t cap = table_end + (size_t)height * width * (rle ? 8 : 4) + (size_t)height * 4;
+    uint8_t *buf = malloc(cap);
+    if (!buf)
+        return 0;
+    sprite_header_t h;
+    memcpy(h.magic, SPRITE_MAGIC, sizeof(h.magic));
+    h.width = width;
+    h.height = height;
+    h.flags = rle ? SPRITE_RLE : 0;
+    memcpy(buf, &h, sizeof(h));
+
+    uint32_t *rows = (uint32_t *)(buf + sizeof(h));
+    uint32_t *p = (uint32_t *)(buf + table_end);
+    for (int r = 0; r < height; r++) {
+        rows[r] = (uint8_t *)p - buf;
+        const uint32_t *line = argb + (size_t)r * width;
+        for (int x = 0; x < width;) {
+            uint32_t *run = rle ? p++ : NULL;
+            int skip = 0, count = 0;
+            while (rle && x < width && (line[x] >> 24) == 0) {
+                x++;
+                skip++;
+            }
+            for (; x < width && (!rle || (line[x] >> 24) != 0); x++, count++) {
+                uint32_t c = line[x], a = c >> 24;
+                uint32_t rr = (((c >> 16) & 0xFF) * a + 127) / 255;
+                uint32_t gg = (((c >> 8) & 0xFF) * a + 127) / 255;
+                uint32_t bb = ((c & 0xFF) * a + 127) / 255;
+                *p++ = a << 24 | rr << 16 | gg << 8 | bb;
+            }
+            if (run)
+                *run = (uint32_t)count << 16 | skip;
+        }
+    }
+    *out = buf;
+    return (uint8_t *)p - buf;
+}
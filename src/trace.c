@@ -0,0 +1,192 @@
+#include "trace.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Events live in a fixed ring (the most recent TRACE_RING_SIZE are kept);
+   per-stage log2 histograms cover the whole run. */
+#define TRACE_RING_SIZE 4096
+#define TRACE_BUCKETS 32    /* bucket b holds durations in [2^(b-1), 2^b) microseconds */
+
+typedef struct {
+    uint64_t start_ns;
+    uint32_t dur_ns;
+    uint8_t stage;
+} trace_event_t;
+
+typedef struct {
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t buckets[TRACE_BUCKETS];
+} trace_hist_t;
+
+int trace_enabled = 0;
+
+static const char *trace_path;
+static trace_event_t ring[TRACE_RING_SIZE];
+static uint64_t ring_head;                  /* total events ever recorded */
+static trace_hist_t hist[TRACE_STAGE_COUNT];
+static uint64_t trace_epoch_ns;
+static uint64_t pending_input_ns;           /* oldest key not yet on screen, 0 if none */
+static uint64_t marks[TRACE_MARK_COUNT];    /* CLOCK_BOOTTIME ns, 0 if not reached */
+
+static const char *stage_names[TRACE_STAGE_COUNT] = {
+    "input", "frame", "base", "text", "present", "flip", "auth", "input_to_present"
+};
+
+static const char *mark_names[TRACE_MARK_COUNT] = {
+    "main", "fb", "loop", "first_frame", "workers", "background", "warm"
+};
+
+void trace_enable(const char *path) {
+    trace_path = path;
+    trace_epoch_ns = trace_now();
+    trace_enabled = 1;
+}
+
+uint64_t trace_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static int bucket_for(uint64_t ns) {
+    uint64_t us = ns / 1000;
+    int b = 0;
+    while (us && b < TRACE_BUCKETS - 1) {
+        us >>= 1;
+        b++;
+    }
+    return b;
+}
+
+void trace_record(trace_stage_t stage, uint64_t start_ns, uint64_t end_ns) {
+    uint64_t dur = end_ns - start_ns;
+    trace_event_t *ev = &ring[ring_head++ % TRACE_RING_SIZE];
+    ev->start_ns = start_ns;
+    ev->dur_ns = dur > UINT32_MAX ? UINT32_MAX : (uint32_t)dur;
+    ev->stage = (uint8_t)stage;
+
+    trace_hist_t *h = &hist[stage];
+    h->count++;
+    h->total_ns += dur;
+    if (dur > h->max_ns)
+        h->max_ns = dur;
+    h->buckets[bucket_for(dur)]++;
+}
+
+/* A key arrived: latency is measured from the first unpresented key */
+void trace_input(void) {
+    if (!trace_enabled)
+        return;
+    uint64_t now = trace_now();
+    trace_record(TRACE_INPUT, now, now);
+    if (!pending_input_ns)
+        pending_input_ns = now;
+}
+
+/* A frame reached the screen */
+void trace_presented(void) {
+    if (!trace_enabled || !pending_input_ns)
+        return;
+    trace_record(TRACE_LATENCY, pending_input_ns, trace_now());
+    pending_input_ns = 0;
+}
+
+static uint64_t boot_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_BOOTTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* A startup milestone was reached.  Milestones are timed against boot so
+   the dump shows where fblogin sits in the boot-to-prompt budget.
+   Returns 1 the first time, 0 after that or when tracing is off. */
+int trace_mark(trace_mark_t mark) {
+    if (!trace_enabled || marks[mark])
+        return 0;
+    marks[mark] = boot_now();
+    return 1;
+}
+
+/* Internal: When this process was exec'd, in ns since boot (field 22 of
+   /proc/self/stat, in clock ticks), or 0 if unknown */
+static uint64_t process_start_ns(void) {
+    FILE *fp = fopen("/proc/self/stat", "r");
+    if (!fp)
+        return 0;
+    char buf[1024];
+    size_t len = fread(buf, 1, sizeof(buf) - 1, fp);
+    fclose(fp);
+    buf[len] = '\0';
+    /* The command name may hold spaces; fields resume after its ')' */
+    char *p = strrchr(buf, ')');
+    unsigned long long ticks;
+    long hz = sysconf(_SC_CLK_TCK);
+    if (!p || hz <= 0 ||
+        sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %*u %*u %*d %*d %*d %*d %*d %*d %llu",
+               &ticks) != 1)
+        return 0;
+    return ticks * (1000000000ULL / hz);
+}
+
+/* Write histograms and the event ring to the trace file; -1 on error */
+int trace_dump(void) {
+    if (!trace_enabled)
+        return 0;
+    FILE *fp = fopen(trace_path, "w");
+    if (!fp) {
+        perror("fopen trace");
+        return -1;
+    }
+    uint64_t kept = ring_head < TRACE_RING_SIZE ? ring_head : TRACE_RING_SIZE;
+    fprintf(fp, "# fblogin trace: %llu events recorded, last %llu kept\n",
+            (unsigned long long)ring_head, (unsigned long long)kept);
+
+    uint64_t exec_ns = process_start_ns();
+    fprintf(fp, "\n# startup\tboot_ms\texec_ms\n");
+    if (exec_ns)
+        fprintf(fp, "exec\t%.1f\t0.0\n", exec_ns / 1e6);
+    for (int m = 0; m < TRACE_MARK_COUNT; m++) {
+        if (!marks[m])
+            continue;
+        fprintf(fp, "%s\t%.1f\t", mark_names[m], marks[m] / 1e6);
+        if (exec_ns)
+            fprintf(fp, "%.1f\n", (marks[m] - exec_ns) / 1e6);
+        else
+            fprintf(fp, "-\n");
+    }
+
+    fprintf(fp, "\n# stage\tcount\tmean_us\tmax_us\n");
+    for (int s = 0; s < TRACE_STAGE_COUNT; s++) {
+        const trace_hist_t *h = &hist[s];
+        if (!h->count || s == TRACE_INPUT)
+            continue;
+        fprintf(fp, "%s\t%llu\t%.1f\t%.1f\n", stage_names[s], (unsigned long long)h->count,
+                h->total_ns / 1e3 / h->count, h->max_ns / 1e3);
+    }
+
+    for (int s = 0; s < TRACE_STAGE_COUNT; s++) {
+        const trace_hist_t *h = &hist[s];
+        if (!h->count || s == TRACE_INPUT)
+            continue;
+        fprintf(fp, "\n# histogram %s (us)\n", stage_names[s]);
+        for (int b = 0; b < TRACE_BUCKETS; b++) {
+            if (!h->buckets[b])
+                continue;
+            unsigned long long lo = b ? 1ULL << (b - 1) : 0, hi = 1ULL << b;
+            fprintf(fp, "[%llu, %llu)\t%llu\n", lo, hi, (unsigned long long)h->buckets[b]);
+        }
+    }
+
+    fprintf(fp, "\n# t_us\tstage\tdur_us\n");
+    for (uint64_t i = ring_head - kept; i < ring_head; i++) {
+        const trace_event_t *ev = &ring[i % TRACE_RING_SIZE];
+        fprintf(fp, "%.1f\t%s\t%.1f\n", (ev->start_ns - trace_epoch_ns) / 1e3,
+                stage_names[ev->stage], ev->dur_ns / 1e3);
+    }
+    return fclose(fp) == 0 ? 0 : -1;
+}
+
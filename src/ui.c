@@ -1,55 +1,73 @@
 #include "ui.h"
 #include "fb.h"
+#include "trace.h"
+#include "rain.h"
+#include "sprite.h"
+#include "wallpaper.h"
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <time.h>
 #include <unistd.h>
-#include <sys/mman.h>
-#include <sys/ioctl.h>
-#include <linux/fb.h>
-
-#ifndef FONT_SCALE
-#define FONT_SCALE 2
-#endif
 
 // Global flag for cmatrix animation.
 static int ui_use_cmatrix = 0;
+// Bumped whenever a theme setting changes, invalidating the cached background.
+static unsigned ui_theme_serial = 0;
 void ui_set_cmatrix(int flag) {
     ui_use_cmatrix = flag;
+    ui_theme_serial++;
 }
 
-/* Internal: Force display update via FBIOPAN_DISPLAY */
-static void fb_update_display(framebuffer_t *fb) {
-    struct fb_var_screeninfo vinfo;
-    if (ioctl(fb->fb_fd, FBIOGET_VSCREENINFO, &vinfo) == 0) {
-        vinfo.xoffset = 0;
-        vinfo.yoffset = 0;
-        ioctl(fb->fb_fd, FBIOPAN_DISPLAY, &vinfo);
-    }
-}
-
-/* Internal: Draw a moving cmatrix background (if enabled) */
-static void ui_draw_cmatrix_background(framebuffer_t *fb) {
-    static int offset = 0;
-    const char charset[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
-    int charCount = strlen(charset);
-    int step = 8 * FONT_SCALE;
-    static int seeded = 0;
-    if (!seeded) {
-        srand(time(NULL));
-        seeded = 1;
-    }
-    for (int y = 0; y < fb->height; y += step) {
-        for (int x = -offset; x < fb->width; x += step) {
-            char c = charset[rand() % charCount];
-            char buf[2] = { c, '\0' };
-            fb_draw_text(fb, x, y, buf, 0x001100);
-        }
-    }
-    offset = (offset + 1) % step;
+// Wallpaper under a static background; cmatrix rain replaces it.
+static const char *ui_wallpaper_path = WALLPAPER_PATH;
+void ui_set_wallpaper(const char *path) {
+    ui_wallpaper_path = path;
+    ui_theme_serial++;
 }
 
+#define UI_TOAST_MS 2000
+#define UI_PANEL_COLOR 0x000000     /* behind the login fields */
+#define UI_PANEL_ALPHA 176
+
+/* A composed background and what it was built for.  With a static theme
+   it holds the cleared screen plus title and spiral, never changes once
+   captured and is shared by every screen it fits; with cmatrix it holds
+   only the rain, which animates in place, so each screen owns its own.
+   A new background is drawn straight to the screen first and composed
+   into its layer at the next ui_tick(), keeping that work off the first
+   frame.  A cached wallpaper is mapped at once and drawn on the first
+   frame too; one that still has to be scaled waits for the compose. */
+typedef struct {
+    fb_layer_t layer;
+    int ready;                  /* the layer is composed */
+    wallpaper_t wallpaper;      /* until composed: the picture under title and logo */
+    int wallpaper_shown;        /* ... and it was on the first frame */
+    int refs;                   /* screens drawing from it */
+    const framebuffer_t *owner; /* cmatrix: the screen whose rain lives here */
+    struct {
+        int width;
+        int height;
+        int bpp;
+        fb_format_t format;
+        int scale;
+        int offset_y;
+        unsigned theme;
+        char hostname[128];
+    } key;
+} ui_base_t;
+
+static ui_base_t ui_bases[UI_MAX_SEATS];
+
+/* Internal: Scale a layout distance.  Offsets were tuned at font scale 2
+   (1080p); keep the same proportions at other resolutions. */
+static int ui_px(const framebuffer_t *fb, int px) {
+    return px * fb->font->scale / 2;
+}
+
+static sprite_t *ui_logo;           /* SPRITE_DIR/logo.fbs, replacing the spiral */
+static int ui_logo_tried;
+
 /* Internal: Draw the Debian spiral (PFP) at the given position */
 static void ui_draw_pfp(framebuffer_t *fb, int x, int y) {
     const char *debian_spiral[] = {
@@ -76,104 +94,767 @@ static void ui_draw_pfp(framebuffer_t *fb, int x, int y) {
     };
     int lines = sizeof(debian_spiral) / sizeof(debian_spiral[0]);
     for (int i = 0; i < lines; i++) {
-        fb_draw_text(fb, x, y + i * 8 * FONT_SCALE, debian_spiral[i], 0xFF0000);
+        fb_draw_text(fb, x, y + i * fb->font->cell_h, debian_spiral[i], 0xFF0000);
     }
 }
 
+/* Retained widgets.  Every screen is the same small tree: title and logo
+   (baked into the cached background) plus either two labeled fields with
+   the user's avatar, or a message line.  Each widget keeps its bounds and the text it last put on
+   screen, so a redraw repaints only the widgets, or glyph cells, that
+   changed. */
+typedef enum {
+    UI_WIDGET_TITLE,
+    UI_WIDGET_LOGO,
+    UI_WIDGET_USERNAME,
+    UI_WIDGET_PASSWORD,
+    UI_WIDGET_AVATAR,
+    UI_WIDGET_MESSAGE,
+    UI_WIDGET_TOAST,
+    UI_WIDGET_COUNT
+} ui_widget_id_t;
+
+typedef enum {
+    UI_SCREEN_NONE,
+    UI_SCREEN_LOGIN,        /* both fields */
+    UI_SCREEN_ERROR,        /* message at the bottom left */
+    UI_SCREEN_MESSAGE       /* centred message below the logo */
+} ui_screen_t;
+
+typedef struct {
+    int visible;
+    int dirty;              /* repaint on the next frame (2: background already restored) */
+    fb_rect_t bounds;       /* everything the widget paints, text included */
+    fb_rect_t box;          /* fields only */
+    fb_rect_t frame;        /* fields only: box plus label */
+    const char *label;      /* fields only */
+    int text_x, text_y;     /* origin of the text */
+    int text_limit;         /* the text may grow up to here without touching the box */
+    int centered;           /* text_x follows the text width */
+    uint32_t color;
+    int cursor;             /* cell of the cursor bar, -1 for none */
+    const sprite_t *sprite; /* image widgets: drawn instead of text, clipped to bounds */
+    char text[256];         /* what is currently on screen */
+} ui_widget_t;
+
+/* Everything the UI keeps per screen, found by framebuffer.  One process
+   may drive several screens (seats); each gets its own widget tree, status
+   line, toast and rain, and a slot is recycled least recently used first
+   when more framebuffers show up than there are slots. */
+typedef struct {
+    framebuffer_t *fb;          /* NULL: free slot */
+    unsigned long used;
+    ui_screen_t screen;
+    int fresh;                  /* the background was just repainted underneath everything */
+    ui_widget_t widgets[UI_WIDGET_COUNT];
+    ui_base_t *base;
+    rain_t rain;
+    uint64_t rain_next_ms;
+    char status[256];           /* status line under the fields (empty for none) */
+    char toast_text[256];       /* toast over the login screen */
+    uint64_t toast_until;       /* when it comes down (monotonic ms) */
+    sprite_t *avatar;           /* of avatar_user, NULL if it has none */
+    char avatar_user[256];
+} ui_seat_t;
+
+static ui_seat_t ui_seats[UI_MAX_SEATS];
+static unsigned long ui_clock;
+
+/* Internal: Drop a screen's hold on its background */
+static void ui_base_release(ui_seat_t *s) {
+    if (s->base && --s->base->refs == 0)
+        s->base->owner = NULL;
+    s->base = NULL;
+}
+
+/* Internal: The state of the screen drawn on fb, claiming a slot for a
+   framebuffer not seen before */
+static ui_seat_t *ui_seat(framebuffer_t *fb) {
+    ui_seat_t *victim = &ui_seats[0];
+    for (int i = 0; i < UI_MAX_SEATS; i++) {
+        ui_seat_t *s = &ui_seats[i];
+        if (s->fb == fb) {
+            s->used = ++ui_clock;
+            return s;
+        }
+        if (s->used < victim->used)
+            victim = s;
+    }
+    ui_base_release(victim);
+    rain_free(&victim->rain);
+    sprite_close(victim->avatar);
+    memset(victim, 0, sizeof(*victim));
+    victim->fb = fb;
+    victim->used = ++ui_clock;
+    return victim;
+}
+
+/* Public: Set the status line shown under the login fields of a screen */
+void ui_set_status(framebuffer_t *fb, const char *status) {
+    ui_seat_t *s = ui_seat(fb);
+    snprintf(s->status, sizeof(s->status), "%s", status ? status : "");
+}
+
+/* Internal: Outline radius for bubble text, thickening with the font scale */
+static int ui_outline_radius(const framebuffer_t *fb) {
+    int radius = fb->font->scale / 2;
+    return radius < 1 ? 1 : radius;
+}
+
 /* Internal: Draw "bubble" text with an outline */
 static void ui_draw_bubble_text(framebuffer_t *fb, int x, int y, const char *text, uint32_t color, uint32_t outline_color) {
-    int offsets[8][2] = {
-        {-1, -1}, { 0, -1}, { 1, -1},
-        {-1,  0},           { 1,  0},
-        {-1,  1}, { 0,  1}, { 1,  1}
-    };
-    for (int i = 0; i < 8; i++) {
-        fb_draw_text(fb, x + offsets[i][0], y + offsets[i][1], text, outline_color);
+    fb_draw_text_outlined(fb, x, y, text, color, outline_color, ui_outline_radius(fb));
+}
+
+/* Internal: Bounding box of a line of text */
+static fb_rect_t ui_text_rect(const framebuffer_t *fb, int x, int y, const char *text) {
+    fb_rect_t r = { x, y, fb_text_width(fb, text), fb->font->cell_h };
+    return r;
+}
+
+static fb_rect_t ui_rect_union(fb_rect_t a, fb_rect_t b) {
+    int x0 = a.x < b.x ? a.x : b.x, y0 = a.y < b.y ? a.y : b.y;
+    int x1 = a.x + a.w > b.x + b.w ? a.x + a.w : b.x + b.w;
+    int y1 = a.y + a.h > b.y + b.h ? a.y + a.h : b.y + b.h;
+    fb_rect_t r = { x0, y0, x1 - x0, y1 - y0 };
+    return r;
+}
+
+static int ui_rect_overlaps(fb_rect_t a, fb_rect_t b) {
+    return a.x < b.x + b.w && b.x < a.x + a.w && a.y < b.y + b.h && b.y < a.y + a.h;
+}
+
+/* Internal: Darken the login fields' boxes within a rectangle, so their
+   text stays readable over rain or a wallpaper.  The panels count as part
+   of the background: they are blended in again wherever it is restored,
+   and never by the fields themselves. */
+static void ui_panels(ui_seat_t *s, fb_rect_t r) {
+    for (int i = UI_WIDGET_USERNAME; i <= UI_WIDGET_PASSWORD; i++) {
+        const ui_widget_t *w = &s->widgets[i];
+        if (!w->visible || !ui_rect_overlaps(r, w->box))
+            continue;
+        int x0 = r.x > w->box.x ? r.x : w->box.x, y0 = r.y > w->box.y ? r.y : w->box.y;
+        int x1 = r.x + r.w < w->box.x + w->box.w ? r.x + r.w : w->box.x + w->box.w;
+        int y1 = r.y + r.h < w->box.y + w->box.h ? r.y + r.h : w->box.y + w->box.h;
+        fb_fill_rect_blend(s->fb, x0, y0, x1 - x0, y1 - y0, UI_PANEL_COLOR, UI_PANEL_ALPHA);
     }
-    fb_draw_text(fb, x, y, text, color);
 }
 
-/* Internal: Draw the base UI (background, title, and Debian spiral) */
-static void ui_draw_base(framebuffer_t *fb, int base_offset_y) {
-    if (ui_use_cmatrix) {
-        ui_draw_cmatrix_background(fb);
+/* Internal: Put back the cached background under a rectangle.  Widgets
+   overlap (the password label sits inside the username box), so any other
+   widget under it is marked for repainting.  On a static background title
+   and logo are part of the layer and come back with it. */
+static void ui_erase(ui_seat_t *s, int owner, int x, int y, int w, int h) {
+    fb_rect_t r = { x, y, w, h };
+    /* Until its layer is composed the background is plain black, and title
+       and logo have to be repainted like any other widget */
+    int layered = s->base && s->base->ready;
+    if (layered)
+        fb_layer_restore(s->fb, &s->base->layer, x, y, w, h);
+    else if (s->base && s->base->wallpaper.data)
+        fb_layer_restore(s->fb, &s->base->wallpaper.layer, x, y, w, h);
+    else
+        fb_draw_rect(s->fb, x, y, w, h, 0x000000);
+    ui_panels(s, r);
+    int first = ui_use_cmatrix || !layered ? UI_WIDGET_TITLE : UI_WIDGET_USERNAME;
+    for (int i = first; i < UI_WIDGET_COUNT; i++) {
+        ui_widget_t *other = &s->widgets[i];
+        if (i != (int)owner && other->visible && !other->dirty && ui_rect_overlaps(r, other->bounds))
+            other->dirty = 1;
+    }
+}
+
+/* Internal: Lay out a labeled input box whose text starts at (x, y) */
+static void ui_layout_field(framebuffer_t *fb, ui_widget_t *w, const char *label, int x, int y) {
+    int box_width = ui_px(fb, 200);
+    int box_height = 30 * fb->font->scale;
+    int pad = ui_px(fb, 5);
+    w->visible = 1;
+    w->label = label;
+    w->box = (fb_rect_t){ x - pad, y - pad, box_width + 2 * pad, box_height + 2 * pad };
+    w->frame = ui_rect_union(w->box, ui_text_rect(fb, x, y - ui_px(fb, 20), label));
+    w->bounds = w->frame;
+    w->text_x = x;
+    w->text_y = y + pad;
+    w->text_limit = w->box.x + w->box.w - 1;
+    w->color = 0x00FF00;
+}
+
+/* Internal: Position every widget of a screen.  All visible widgets start
+   dirty with no text on screen. */
+static void ui_layout(ui_seat_t *s, ui_screen_t screen, const char *hostname) {
+    framebuffer_t *fb = s->fb;
+    ui_widget_t *w = s->widgets;
+    memset(w, 0, sizeof(s->widgets));
+    s->screen = screen;
+
+    ui_widget_t *title = &w[UI_WIDGET_TITLE];
+    int radius = ui_outline_radius(fb);
+    snprintf(title->text, sizeof(title->text), "Login for %s", hostname);
+    title->visible = 1;
+    title->text_x = (fb->width - fb_text_width(fb, title->text)) / 2;
+    title->text_y = ui_px(fb, 20);
+    title->bounds = ui_text_rect(fb, title->text_x - radius, title->text_y - radius, title->text);
+    title->bounds.w += 2 * radius;
+    title->bounds.h += 2 * radius;
+    title->color = 0xFFFFFF;
+
+    // Debian spiral below title (position adjusted to stay on frame for fingerprint and welcome)
+    ui_widget_t *logo = &w[UI_WIDGET_LOGO];
+    logo->visible = 1;
+    logo->text_y = title->text_y + ui_px(fb, 60);  // moved lower
+    logo->color = 0xFF0000;
+    if (!ui_logo_tried) {
+        ui_logo = sprite_open(SPRITE_DIR "/logo.fbs");
+        ui_logo_tried = 1;
+    }
+    if (ui_logo) {
+        /* Centred, and cut off above the fields and messages */
+        int max_h = ui_px(fb, 320);
+        logo->sprite = ui_logo;
+        logo->text_x = (fb->width - ui_logo->width) / 2;
+        logo->bounds = (fb_rect_t){ logo->text_x, logo->text_y, ui_logo->width,
+                                    ui_logo->height < max_h ? ui_logo->height : max_h };
     } else {
+        logo->text_x = (fb->width - 29 * fb->font->cell_w) / 2;
+        logo->bounds = (fb_rect_t){ logo->text_x, logo->text_y, 30 * fb->font->cell_w, 20 * fb->font->cell_h };
+    }
+
+    if (screen == UI_SCREEN_LOGIN) {
+        int username_x = (fb->width - ui_px(fb, 200)) / 2;
+        int username_y = ui_px(fb, 450);  // moved down a few spaces
+        int password_y = username_y + 30 * fb->font->scale + ui_px(fb, 10);
+        ui_layout_field(fb, &w[UI_WIDGET_USERNAME], "Username:", username_x, username_y);
+        ui_layout_field(fb, &w[UI_WIDGET_PASSWORD], "Password:", username_x, password_y);
+        /* A square left of the fields, as tall as both together */
+        const ui_widget_t *user = &w[UI_WIDGET_USERNAME], *pass = &w[UI_WIDGET_PASSWORD];
+        int side = pass->box.y + pass->box.h - user->frame.y;
+        ui_widget_t *avatar = &w[UI_WIDGET_AVATAR];
+        avatar->visible = 1;
+        avatar->bounds = (fb_rect_t){ user->box.x - ui_px(fb, 20) - side, user->frame.y, side, side };
+        ui_widget_t *status = &w[UI_WIDGET_MESSAGE];
+        status->visible = 1;
+        status->centered = 1;
+        status->text_y = password_y + 30 * fb->font->scale + ui_px(fb, 20);
+        status->color = 0xAAAAAA;
+        ui_widget_t *toast = &w[UI_WIDGET_TOAST];
+        toast->visible = 1;
+        toast->text_x = ui_px(fb, 10);
+        toast->text_y = fb->height - ui_px(fb, 40);
+        toast->text_limit = fb->width;
+        toast->color = 0xFF0000;
+    } else if (screen == UI_SCREEN_ERROR) {
+        ui_widget_t *msg = &w[UI_WIDGET_MESSAGE];
+        msg->visible = 1;
+        msg->text_x = ui_px(fb, 10);
+        msg->text_y = fb->height - ui_px(fb, 40);
+        msg->text_limit = fb->width;
+        msg->color = 0xFF0000;
+    } else {
+        ui_widget_t *msg = &w[UI_WIDGET_MESSAGE];
+        msg->visible = 1;
+        msg->centered = 1;
+        msg->text_y = ui_px(fb, 420);  // positioned a few spaces lower
+        msg->color = 0xFFFFFF;
+    }
+    for (int i = 0; i < UI_WIDGET_COUNT; i++) {
+        w[i].dirty = w[i].visible;
+        w[i].cursor = -1;
+    }
+}
+
+/* Internal: The cursor bar sits just under its glyph cell */
+static fb_rect_t ui_cursor_rect(const framebuffer_t *fb, const ui_widget_t *w) {
+    int scale = fb->font->scale;
+    fb_rect_t r = { w->text_x + w->cursor * fb->font->cell_w, w->text_y + fb->font->cell_h + scale,
+                    fb->font->cell_w, scale };
+    return r;
+}
+
+/* Internal: Recompute what a widget covers after its text or cursor moved */
+static void ui_widget_bounds(const framebuffer_t *fb, ui_widget_t *w) {
+    w->bounds = ui_text_rect(fb, w->text_x, w->text_y, w->text);
+    if (w->label)
+        w->bounds = ui_rect_union(w->frame, w->bounds);
+    if (w->cursor >= 0)
+        w->bounds = ui_rect_union(w->bounds, ui_cursor_rect(fb, w));
+}
+
+/* Internal: Draw the logo widget: the logo sprite if there is one, else
+   the spiral */
+static void ui_draw_logo(framebuffer_t *fb, const ui_widget_t *logo) {
+    if (logo->sprite)
+        sprite_draw(fb, logo->sprite, logo->text_x, logo->text_y, &logo->bounds);
+    else
+        ui_draw_pfp(fb, logo->text_x, logo->text_y);
+}
+
+/* Internal: Paint a widget over whatever is beneath it */
+static void ui_widget_paint(ui_seat_t *s, ui_widget_id_t id) {
+    framebuffer_t *fb = s->fb;
+    ui_widget_t *w = &s->widgets[id];
+    switch (id) {
+    case UI_WIDGET_TITLE:
+        ui_draw_bubble_text(fb, w->text_x, w->text_y, w->text, w->color, 0x000000);
+        break;
+    case UI_WIDGET_LOGO:
+        ui_draw_logo(fb, w);
+        break;
+    case UI_WIDGET_AVATAR:
+        if (w->sprite)
+            sprite_draw(fb, w->sprite, w->bounds.x + (w->bounds.w - w->sprite->width) / 2,
+                        w->bounds.y + (w->bounds.h - w->sprite->height) / 2, &w->bounds);
+        break;
+    case UI_WIDGET_USERNAME:
+    case UI_WIDGET_PASSWORD:
+        fb_draw_rect_outline(fb, w->box.x, w->box.y, w->box.w, w->box.h, 0xFFFFFF);
+        fb_draw_text(fb, w->text_x, w->frame.y, w->label, 0xFFFFFF);
+        fb_draw_text(fb, w->text_x, w->text_y, w->text, w->color);
+        if (w->cursor >= 0) {
+            fb_rect_t bar = ui_cursor_rect(fb, w);
+            fb_draw_rect(fb, bar.x, bar.y, bar.w, bar.h, 0xFFFFFF);
+        }
+        break;
+    default:
+        fb_draw_text(fb, w->text_x, w->text_y, w->text, w->color);
+        break;
+    }
+    w->dirty = 0;
+}
+
+/* Internal: Change a widget's text.  When the widget is otherwise up to date
+   only the glyph cells that differ are restored and redrawn; text that moves
+   (centred) or spills over its box dirties the whole widget instead. */
+static void ui_widget_set_text(ui_seat_t *s, ui_widget_id_t id, const char *text) {
+    framebuffer_t *fb = s->fb;
+    ui_widget_t *w = &s->widgets[id];
+    if (strncmp(w->text, text, sizeof(w->text) - 1) == 0)
+        return;
+    int cell_w = fb->font->cell_w, cell_h = fb->font->cell_h;
+    int old_len = strlen(w->text);
+    int new_len = strnlen(text, sizeof(w->text) - 1);
+    int len = old_len > new_len ? old_len : new_len;
+
+    if (w->dirty == 1 || (!w->dirty && (w->centered || w->text_x + len * cell_w > w->text_limit))) {
+        /* Clear what the old text covered now: the bounds change below */
+        ui_erase(s, id, w->bounds.x, w->bounds.y, w->bounds.w, w->bounds.h);
+        w->dirty = 1;
+    } else if (!w->dirty) {
+        for (int i = 0; i < len;) {
+            if (i < old_len && i < new_len && w->text[i] == text[i]) {
+                i++;
+                continue;
+            }
+            int start = i;
+            while (i < len && !(i < old_len && i < new_len && w->text[i] == text[i]))
+                i++;
+            ui_erase(s, id, w->text_x + start * cell_w, w->text_y, (i - start) * cell_w, cell_h);
+            if (start < new_len) {
+                char run[256];
+                int n = (i < new_len ? i : new_len) - start;
+                memcpy(run, text + start, n);
+                run[n] = '\0';
+                fb_draw_text(fb, w->text_x + start * cell_w, w->text_y, run, w->color);
+            }
+        }
+    }
+    memcpy(w->text, text, new_len);
+    w->text[new_len] = '\0';
+    if (w->centered)
+        w->text_x = (fb->width - fb_text_width(fb, w->text)) / 2;
+    ui_widget_bounds(fb, w);
+}
+
+/* Internal: Move a field's cursor bar (-1 hides it) */
+static void ui_widget_set_cursor(ui_seat_t *s, ui_widget_id_t id, int cursor) {
+    framebuffer_t *fb = s->fb;
+    ui_widget_t *w = &s->widgets[id];
+    if (w->cursor == cursor)
+        return;
+    if (w->dirty != 2 && w->cursor >= 0) {
+        fb_rect_t old = ui_cursor_rect(fb, w);
+        ui_erase(s, id, old.x, old.y, old.w, old.h);
+    }
+    w->cursor = cursor;
+    if (!w->dirty && cursor >= 0) {
+        fb_rect_t bar = ui_cursor_rect(fb, w);
+        fb_draw_rect(fb, bar.x, bar.y, bar.w, bar.h, 0xFFFFFF);
+    }
+    ui_widget_bounds(fb, w);
+}
+
+/* Internal: Change an image widget's sprite (NULL: show nothing).  Its
+   bounds stay put, so the old image is erased and the new one painted with
+   the frame. */
+static void ui_widget_set_sprite(ui_seat_t *s, ui_widget_id_t id, const sprite_t *sprite) {
+    ui_widget_t *w = &s->widgets[id];
+    if (w->sprite == sprite)
+        return;
+    if (!w->dirty) {
+        ui_erase(s, id, w->bounds.x, w->bounds.y, w->bounds.w, w->bounds.h);
+        w->dirty = 2;
+    }
+    w->sprite = sprite;
+}
+
+/* Internal: The avatar of a user, SPRITE_DIR/avatars/USER.fbs, opened when
+   the user changes.  Names that could leave that directory get none. */
+static const sprite_t *ui_avatar(ui_seat_t *s, const char *user) {
+    if (strncmp(s->avatar_user, user, sizeof(s->avatar_user) - 1) != 0) {
+        sprite_close(s->avatar);
+        s->avatar = NULL;
+        snprintf(s->avatar_user, sizeof(s->avatar_user), "%s", user);
+        if (user[0] && user[0] != '.' && !strchr(user, '/')) {
+            char path[512];
+            snprintf(path, sizeof(path), SPRITE_DIR "/avatars/%s.fbs", s->avatar_user);
+            s->avatar = sprite_open(path);
+        }
+    }
+    return s->avatar;
+}
+
+/* Internal: One glyph per code point: the font covers ASCII only, so other
+   characters show as '?', or everything as '*' when masked */
+static void ui_field_glyphs(char *dst, size_t size, const char *src, int masked) {
+    size_t n = 0;
+    for (const unsigned char *p = (const unsigned char *)src; *p && n + 1 < size; p++) {
+        if ((*p & 0xC0) == 0x80)
+            continue;
+        dst[n++] = masked ? '*' : *p < 0x80 ? (char)*p : '?';
+    }
+    dst[n] = '\0';
+}
+
+/* Internal: Was a background built for this screen as it is now? */
+static int ui_base_fits(const ui_base_t *base, const framebuffer_t *fb, int base_offset_y,
+                        const char *hostname) {
+    return base->refs > 0 && base->key.width == fb->width && base->key.height == fb->height &&
+           base->key.bpp == fb->bpp && memcmp(&base->key.format, &fb->format, sizeof(fb->format)) == 0 &&
+           base->key.scale == fb->font->scale && base->key.offset_y == base_offset_y &&
+           base->key.theme == ui_theme_serial && strcmp(base->key.hostname, hostname) == 0;
+}
+
+/* Internal: Is the cached background valid for this screen? */
+static int ui_base_cached(const ui_seat_t *s, int base_offset_y, const char *hostname) {
+    return s->base && ui_base_fits(s->base, s->fb, base_offset_y, hostname);
+}
+
+/* Internal: A static background another screen already composed for the
+   same geometry, hostname and theme */
+static ui_base_t *ui_base_shared(const framebuffer_t *fb, int base_offset_y, const char *hostname) {
+    if (ui_use_cmatrix)
+        return NULL;
+    for (int i = 0; i < UI_MAX_SEATS; i++) {
+        ui_base_t *base = &ui_bases[i];
+        if (!base->owner && ui_base_fits(base, fb, base_offset_y, hostname))
+            return base;
+    }
+    return NULL;
+}
+
+/* Internal: Draw the base UI (background or wallpaper, field panels, title,
+   and Debian spiral).  The composed result, less the panels, is cached in
+   a layer and rebuilt only when the resolution, hostname or theme changes;
+   screens alike share one static layer.  With cmatrix the layer holds just
+   the rain, and title and spiral are painted on top as widgets. */
+static void ui_draw_base(ui_seat_t *s, int base_offset_y, const char *hostname) {
+    framebuffer_t *fb = s->fb;
+    uint64_t t = trace_begin();
+    ui_base_t *base = ui_base_cached(s, base_offset_y, hostname) ? s->base :
+                      ui_base_shared(fb, base_offset_y, hostname);
+    if (base && base != s->base) {
+        ui_base_release(s);
+        s->base = base;
+        base->refs++;
+    }
+    if (base && base->ready) {
+        fb_layer_restore(fb, &base->layer, 0, 0, fb->width, fb->height);
+        ui_panels(s, (fb_rect_t){ 0, 0, fb->width, fb->height });
+        if (!ui_use_cmatrix) {
+            s->widgets[UI_WIDGET_TITLE].dirty = 0;
+            s->widgets[UI_WIDGET_LOGO].dirty = 0;
+        }
+        trace_end(TRACE_BASE, t);
+        return;
+    }
+
+    /* Claim a layer nobody else draws from: this screen's own if it was
+       not shared, otherwise one that is free.  There is a layer per slot,
+       so one always is.  ui_tick() composes it. */
+    if (!base) {
+        ui_base_release(s);
+        for (int i = 0; i < UI_MAX_SEATS && !base; i++)
+            if (ui_bases[i].refs == 0)
+                base = &ui_bases[i];
+        s->base = base;
+        base->refs = 1;
+        base->ready = 0;
+        base->owner = ui_use_cmatrix ? fb : NULL;
+        base->key.width = fb->width;
+        base->key.height = fb->height;
+        base->key.bpp = fb->bpp;
+        base->key.format = fb->format;
+        base->key.scale = fb->font->scale;
+        base->key.offset_y = base_offset_y;
+        base->key.theme = ui_theme_serial;
+        memcpy(base->key.hostname, hostname, sizeof(base->key.hostname));
+        wallpaper_close(&base->wallpaper);
+        base->wallpaper_shown = !ui_use_cmatrix && ui_wallpaper_path &&
+                                wallpaper_open(&base->wallpaper, ui_wallpaper_path, fb, 0) == 0;
+    }
+
+    if (base->wallpaper.data)
+        fb_layer_restore(fb, &base->wallpaper.layer, 0, 0, fb->width, fb->height);
+    else
         fb_clear(fb, 0x000000);
+    ui_panels(s, (fb_rect_t){ 0, 0, fb->width, fb->height });
+    if (!ui_use_cmatrix) {
+        ui_widget_paint(s, UI_WIDGET_TITLE);
+        ui_widget_paint(s, UI_WIDGET_LOGO);
     }
+    trace_end(TRACE_BASE, t);
+}
+
+/* Internal: Start a frame of the given screen.  Switching screens, or any
+   change to the background, repaints everything; otherwise the frame only
+   touches what the widgets report as changed. */
+static void ui_begin_frame(ui_seat_t *s, ui_screen_t screen) {
     char hostname[128] = {0};
-    gethostname(hostname, sizeof(hostname));
-    char title[256];
-    snprintf(title, sizeof(title), "Login for %s", hostname);
-    int title_width = strlen(title) * 8 * FONT_SCALE;
-    int title_x = (fb->width - title_width) / 2;
-    int title_y = base_offset_y; 
-    ui_draw_bubble_text(fb, title_x, title_y, title, 0xFFFFFF, 0x000000);
-    
-    // Draw Debian spiral below title (position adjusted to stay on frame for fingerprint and welcome)
-    int spiral_width = 29 * 8 * FONT_SCALE;
-    int spiral_x = (fb->width - spiral_width) / 2;
-    int spiral_y = title_y + 60;  // moved lower
-    ui_draw_pfp(fb, spiral_x, spiral_y);
-}
-
-/* Public: Draw login screen with text boxes (moved lower) */
-void ui_draw_login(framebuffer_t *fb, const char *username, const char *password) {
-    ui_draw_base(fb, 20);
-    
-    int box_width = 200;
-    int box_height = 30 * FONT_SCALE;
-    int username_box_x = (fb->width - box_width) / 2;
-    int username_box_y = 450;  // moved down a few spaces
-    int password_box_x = username_box_x;
-    int password_box_y = username_box_y + box_height + 10;
-    
-    fb_draw_rect_outline(fb, username_box_x - 5, username_box_y - 5, box_width + 10, box_height + 10, 0xFFFFFF);
-    fb_draw_rect_outline(fb, password_box_x - 5, password_box_y - 5, box_width + 10, box_height + 10, 0xFFFFFF);
-    
-    fb_draw_text(fb, username_box_x, username_box_y - 20, "Username:", 0xFFFFFF);
-    fb_draw_text(fb, username_box_x, username_box_y + 5, username, 0x00FF00);
-    
-    fb_draw_text(fb, password_box_x, password_box_y - 20, "Password:", 0xFFFFFF);
-    char masked[256] = {0};
-    int len = strlen(password);
-    for (int i = 0; i < len && i < 255; i++) {
-        masked[i] = '*';
-    }
-    fb_draw_text(fb, password_box_x, password_box_y + 5, masked, 0x00FF00);
-    
-    msync(fb->fb_ptr, fb->fb_size, MS_SYNC);
-    fb_update_display(fb);
-}
-
-/* Public: Draw error message screen (with base UI still visible) */
+    gethostname(hostname, sizeof(hostname) - 1);
+    int base_offset_y = ui_px(s->fb, 20);
+    s->fresh = s->screen != screen || !ui_base_cached(s, base_offset_y, hostname);
+    if (!s->fresh)
+        return;
+    ui_layout(s, screen, hostname);
+    ui_draw_base(s, base_offset_y, hostname);
+}
+
+/* Internal: Paint the remaining dirty widgets and present the result.
+   Unless the background was just repainted, every dirty widget is erased
+   first (which may dirty widgets it overlaps, so repeat until nothing new
+   turns up), then all are painted in tree order. */
+static void ui_end_frame(ui_seat_t *s) {
+    ui_widget_t *w = s->widgets;
+    for (int again = !s->fresh; again;) {
+        again = 0;
+        for (int i = 0; i < UI_WIDGET_COUNT; i++) {
+            if (w[i].visible && w[i].dirty == 1) {
+                w[i].dirty = 2;
+                ui_erase(s, i, w[i].bounds.x, w[i].bounds.y, w[i].bounds.w, w[i].bounds.h);
+                again = 1;
+            }
+        }
+    }
+    for (int i = 0; i < UI_WIDGET_COUNT; i++) {
+        if (w[i].visible && w[i].dirty)
+            ui_widget_paint(s, i);
+    }
+    fb_present(s->fb);
+}
+
+/* Internal: Compose a screen's pending background layer off-screen.  The
+   screen usually shows the same pixels already (black or the wallpaper,
+   plus title and logo), so nothing needs repainting; from here on erasing
+   restores from the layer instead of redrawing title and logo.  Only a
+   wallpaper scaled just now is new, and every screen on this background
+   is repainted to show it. */
+static void ui_base_compose(ui_seat_t *s) {
+    ui_base_t *base = s->base;
+    uint64_t t = trace_begin();
+    framebuffer_t view;
+    if (!ui_use_cmatrix && ui_wallpaper_path && !base->wallpaper.data)
+        wallpaper_open(&base->wallpaper, ui_wallpaper_path, s->fb, 1);
+    if (fb_layer_alloc(s->fb, &base->layer) < 0)
+        return;     // try again next tick; the screen works without it
+    fb_layer_view(s->fb, &base->layer, &view);
+    if (ui_use_cmatrix) {
+        /* Seeded per slot so neighbouring screens do not rain in step */
+        uint32_t seed = (uint32_t)time(NULL) ^ (uint32_t)(s - ui_seats) * 0x9E3779B9u;
+        if (rain_init(&s->rain, &view, seed) < 0)
+            return;
+    } else {
+        const ui_widget_t *title = &s->widgets[UI_WIDGET_TITLE];
+        const ui_widget_t *logo = &s->widgets[UI_WIDGET_LOGO];
+        if (base->wallpaper.data)
+            fb_layer_restore(&view, &base->wallpaper.layer, 0, 0, view.width, view.height);
+        else
+            fb_clear(&view, 0x000000);
+        ui_draw_bubble_text(&view, title->text_x, title->text_y, title->text, title->color, 0x000000);
+        ui_draw_logo(&view, logo);
+    }
+    int repaint = base->wallpaper.data && !base->wallpaper_shown;
+    wallpaper_close(&base->wallpaper);
+    base->ready = 1;
+    trace_end(TRACE_BASE, t);
+    trace_mark(TRACE_MARK_BACKGROUND);
+    for (int i = 0; repaint && i < UI_MAX_SEATS; i++) {
+        ui_seat_t *other = &ui_seats[i];
+        if (other->base == base && other->screen != UI_SCREEN_NONE) {
+            ui_erase(other, -1, 0, 0, other->fb->width, other->fb->height);
+            other->fresh = 0;
+            ui_end_frame(other);
+        }
+    }
+}
+
+static uint64_t ui_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Internal: Put the current toast, or nothing, on the login screen */
+static void ui_toast_frame(ui_seat_t *s, const char *text) {
+    uint64_t t = trace_begin();
+    ui_begin_frame(s, UI_SCREEN_LOGIN);
+    ui_widget_set_text(s, UI_WIDGET_TOAST, text);
+    ui_end_frame(s);
+    trace_end(TRACE_FRAME, t);
+}
+
+/* Public: Show a message over the login screen for ms milliseconds while
+   input carries on.  Every login frame composites it until the deadline,
+   and ui_tick() takes it down. */
+void ui_toast(framebuffer_t *fb, const char *message, int ms) {
+    ui_seat_t *s = ui_seat(fb);
+    snprintf(s->toast_text, sizeof(s->toast_text), "%s", message);
+    s->toast_until = ui_now_ms() + ms;
+    if (s->screen == UI_SCREEN_LOGIN)
+        ui_toast_frame(s, s->toast_text);
+}
+
+/* Internal: Expire the toast.  Returns the milliseconds it has left, or
+   -1 if there is none. */
+static int ui_toast_tick(ui_seat_t *s) {
+    if (!s->toast_text[0])
+        return -1;
+    uint64_t now = ui_now_ms();
+    if (now < s->toast_until)
+        return (int)(s->toast_until - now);
+    s->toast_text[0] = '\0';
+    if (s->screen == UI_SCREEN_LOGIN)
+        ui_toast_frame(s, "");
+    return -1;
+}
+
+/* Internal: Step the rain of a screen and repaint what it uncovered */
+static void ui_rain_frame(ui_seat_t *s) {
+    uint64_t t = trace_begin();
+    uint64_t tb = trace_begin();
+    framebuffer_t view;
+    fb_layer_view(s->fb, &s->base->layer, &view);
+    rain_tick(&s->rain, &view);
+    trace_end(TRACE_BASE, tb);
+    s->fresh = 0;
+    for (int i = 0; i < s->rain.changed_count; i++) {
+        fb_rect_t *d = &s->rain.changed[i];
+        ui_erase(s, -1, d->x, d->y, d->w, d->h);
+    }
+    ui_end_frame(s);
+    trace_end(TRACE_FRAME, t);
+}
+
+static int ui_rain_active(const ui_seat_t *s) {
+    return ui_use_cmatrix && s->screen != UI_SCREEN_NONE && s->base && s->base->ready &&
+           s->rain.columns;
+}
+
+/* Public: Draw the next animation frame now: step the rain inside the
+   background layer, restore the strips it touched and repaint whatever
+   widgets sit on them */
+void ui_animate(framebuffer_t *fb) {
+    ui_seat_t *s = ui_seat(fb);
+    if (ui_rain_active(s))
+        ui_rain_frame(s);
+}
+
+/* Internal: Step the rain if a frame is due */
+static int ui_rain_tick(ui_seat_t *s) {
+    if (!ui_rain_active(s))
+        return -1;
+    const uint64_t period = 1000 / RAIN_FPS;
+    uint64_t now = ui_now_ms();
+    if (now < s->rain_next_ms)
+        return (int)(s->rain_next_ms - now);
+    /* Frames missed while blocked elsewhere are dropped, not replayed */
+    s->rain_next_ms = now - s->rain_next_ms < period ? s->rain_next_ms + period : now + period;
+    ui_rain_frame(s);
+    return (int)(s->rain_next_ms - now);
+}
+
+/* Public: Run whatever is due on a screen (a pending background, rain
+   frames, toast expiry) and return the milliseconds until something next
+   is, or -1 when nothing is pending. */
+int ui_tick(framebuffer_t *fb) {
+    ui_seat_t *s = ui_seat(fb);
+    if (s->screen != UI_SCREEN_NONE && s->base && !s->base->ready)
+        ui_base_compose(s);
+    int toast = ui_toast_tick(s);
+    int rain_wait = ui_rain_tick(s);
+    if (toast < 0 || (rain_wait >= 0 && rain_wait < toast))
+        return rain_wait;
+    return toast;
+}
+
+/* Public: Forget what is on a screen (every screen for NULL); the next
+   draw repaints everything */
+void ui_invalidate(framebuffer_t *fb) {
+    for (int i = 0; i < UI_MAX_SEATS; i++)
+        if (ui_seats[i].fb && (!fb || ui_seats[i].fb == fb))
+            ui_seats[i].screen = UI_SCREEN_NONE;
+}
+
+/* Public: Draw login screen with text boxes (moved lower).  The cursor bar
+   goes under character `cursor` of the active field (0: username,
+   1: password); a negative cursor hides it. */
+void ui_draw_login(framebuffer_t *fb, const char *username, const char *password,
+                   int active, int cursor) {
+    uint64_t t = trace_begin();
+    ui_seat_t *s = ui_seat(fb);
+    ui_begin_frame(s, UI_SCREEN_LOGIN);
+    char shown[256];
+    ui_field_glyphs(shown, sizeof(shown), username, 0);
+    ui_widget_set_text(s, UI_WIDGET_USERNAME, shown);
+    ui_field_glyphs(shown, sizeof(shown), password, 1);
+    ui_widget_set_text(s, UI_WIDGET_PASSWORD, shown);
+    ui_widget_set_text(s, UI_WIDGET_MESSAGE, s->status);
+    ui_widget_set_text(s, UI_WIDGET_TOAST, s->toast_text);
+    ui_widget_set_cursor(s, UI_WIDGET_USERNAME, active == 0 ? cursor : -1);
+    ui_widget_set_cursor(s, UI_WIDGET_PASSWORD, active == 1 ? cursor : -1);
+    /* Once the username is accepted */
+    ui_widget_set_sprite(s, UI_WIDGET_AVATAR, active == 1 ? ui_avatar(s, username) : NULL);
+    ui_end_frame(s);
+    trace_end(TRACE_FRAME, t);
+}
+
+/* Public: Draw an error.  Over the login screen it is a toast that leaves
+   the fields usable; elsewhere it gets a screen of its own. */
 void ui_draw_error(framebuffer_t *fb, const char *message) {
-    ui_draw_base(fb, 20);
-    fb_draw_text(fb, 10, fb->height - 40, message, 0xFF0000);
-    msync(fb->fb_ptr, fb->fb_size, MS_SYNC);
-    fb_update_display(fb);
+    ui_seat_t *s = ui_seat(fb);
+    if (s->screen == UI_SCREEN_LOGIN) {
+        ui_toast(fb, message, UI_TOAST_MS);
+        return;
+    }
+    uint64_t t = trace_begin();
+    ui_begin_frame(s, UI_SCREEN_ERROR);
+    ui_widget_set_text(s, UI_WIDGET_MESSAGE, message);
+    ui_end_frame(s);
+    trace_end(TRACE_FRAME, t);
 }
 
 /* Public: Draw welcome screen (keep base UI and place message lower) */
 void ui_draw_welcome(framebuffer_t *fb, const char *username) {
-    ui_draw_base(fb, 20);
     char welcome[256];
     snprintf(welcome, sizeof(welcome), "Welcome, %s!", username);
-    int text_width = strlen(welcome) * 8 * FONT_SCALE;
-    int x = (fb->width - text_width) / 2;
-    int y = 420;  // positioned a few spaces lower
-    fb_draw_text(fb, x, y, welcome, 0xFFFFFF);
-    msync(fb->fb_ptr, fb->fb_size, MS_SYNC);
-    fb_update_display(fb);
+    ui_draw_message(fb, welcome);
 }
 
 /* Public: Draw a general message screen (again, base UI remains) */
 void ui_draw_message(framebuffer_t *fb, const char *msg) {
-    ui_draw_base(fb, 20);
-    int text_width = strlen(msg) * 8 * FONT_SCALE;
-    int x = (fb->width - text_width) / 2;
-    int y = 420;  // message position, lower than before
-    fb_draw_text(fb, x, y, msg, 0xFFFFFF);
-    msync(fb->fb_ptr, fb->fb_size, MS_SYNC);
-    fb_update_display(fb);
+    uint64_t t = trace_begin();
+    ui_seat_t *s = ui_seat(fb);
+    ui_begin_frame(s, UI_SCREEN_MESSAGE);
+    ui_widget_set_text(s, UI_WIDGET_MESSAGE, msg);
+    ui_end_frame(s);
+    trace_end(TRACE_FRAME, t);
 }
-
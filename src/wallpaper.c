@@ -0,0 +1,477 @@
+#include "wallpaper.h"
+#include "fb_blend.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* A wallpaper is decoded and scaled once per source and screen format;
+   every later start only stats the source and maps the cached result,
+   which the UI then copies row by row like any other layer.  The source
+   is read and hashed only when its stat() changed, off the first frame. */
+
+/* Internal: FNV-1a over the source file, the cache key */
+static uint64_t wallpaper_hash(const uint8_t *data, size_t size) {
+    uint64_t h = 0xCBF29CE484222325ull;
+    for (size_t i = 0; i < size; i++)
+        h = (h ^ data[i]) * 0x100000001B3ull;
+    return h;
+}
+
+/* Internal: Next decimal header field of a PPM, skipping whitespace and
+   comments; -1 if there is none */
+static long wallpaper_ppm_field(const uint8_t *data, size_t size, size_t *pos) {
+    size_t p = *pos;
+    for (;;) {
+        while (p < size && (data[p] == ' ' || data[p] == '\t' || data[p] == '\n' || data[p] == '\r'))
+            p++;
+        if (p < size && data[p] == '#') {
+            while (p < size && data[p] != '\n')
+                p++;
+            continue;
+        }
+        break;
+    }
+    long value = 0;
+    size_t start = p;
+    while (p < size && data[p] >= '0' && data[p] <= '9' && value <= WALLPAPER_MAX_SIZE)
+        value = value * 10 + (data[p++] - '0');
+    *pos = p;
+    return p > start ? value : -1;
+}
+
+/* Internal: Decode a binary PPM (P6, 8-bit) */
+static uint32_t *wallpaper_decode_ppm(const uint8_t *data, size_t size, int *width, int *height) {
+    size_t p = 2;
+    long w = wallpaper_ppm_field(data, size, &p);
+    long h = wallpaper_ppm_field(data, size, &p);
+    long maxval = wallpaper_ppm_field(data, size, &p);
+    if (w <= 0 || h <= 0 || w > WALLPAPER_MAX_SIZE || h > WALLPAPER_MAX_SIZE || maxval != 255 ||
+        p >= size)
+        return NULL;
+    p++;    /* the single whitespace byte before the raster */
+    if ((size - p) / 3 / w < (size_t)h)
+        return NULL;
+    uint32_t *pixels = malloc((size_t)w * h * 4);
+    if (!pixels)
+        return NULL;
+    const uint8_t *s = data + p;
+    for (size_t i = 0; i < (size_t)w * h; i++, s += 3)
+        pixels[i] = (uint32_t)s[0] << 16 | s[1] << 8 | s[2];
+    *width = w;
+    *height = h;
+    return pixels;
+}
+
+/* Internal: Decode a QOI image (qoiformat.org).  Transparent pixels are
+   composited over black, like the screen under them. */
+static uint32_t *wallpaper_decode_qoi(const uint8_t *data, size_t size, int *width, int *height) {
+    if (size < 14 + 8)
+        return NULL;
+    uint32_t w = (uint32_t)data[4] << 24 | data[5] << 16 | data[6] << 8 | data[7];
+    uint32_t h = (uint32_t)data[8] << 24 | data[9] << 16 | data[10] << 8 | data[11];
+    if (w == 0 || h == 0 || w > WALLPAPER_MAX_SIZE || h > WALLPAPER_MAX_SIZE)
+        return NULL;
+    uint32_t *pixels = malloc((size_t)w * h * 4);
+    if (!pixels)
+        return NULL;
+    uint8_t index[64][4] = {{0}};
+    uint8_t px[4] = { 0, 0, 0, 255 };   /* r, g, b, a */
+    size_t p = 14, end = size - 8;      /* the stream ends with 8 bytes of padding */
+    int run = 0;
+    for (size_t i = 0; i < (size_t)w * h; i++) {
+        if (run > 0) {
+            run--;
+        } else {
+            if (p >= end)
+                goto bad;
+            uint8_t b1 = data[p++];
+            if (b1 == 0xFE) {
+                memcpy(px, data + p, 3);
+                p += 3;
+            } else if (b1 == 0xFF) {
+                memcpy(px, data + p, 4);
+                p += 4;
+            } else if ((b1 & 0xC0) == 0x00) {
+                memcpy(px, index[b1], 4);
+            } else if ((b1 & 0xC0) == 0x40) {
+                px[0] += ((b1 >> 4) & 3) - 2;
+                px[1] += ((b1 >> 2) & 3) - 2;
+                px[2] += (b1 & 3) - 2;
+            } else if ((b1 & 0xC0) == 0x80) {
+                uint8_t b2 = data[p++];
+                int dg = (b1 & 0x3F) - 32;
+                px[0] += dg - 8 + ((b2 >> 4) & 0xF);
+                px[1] += dg;
+                px[2] += dg - 8 + (b2 & 0xF);
+            } else {
+                run = b1 & 0x3F;
+            }
+            if (p > end)
+                goto bad;
+            memcpy(index[(px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11) % 64], px, 4);
+        }
+        uint32_t rgb = (uint32_t)px[0] << 16 | px[1] << 8 | px[2];
+        pixels[i] = px[3] == 255 ? rgb : fb_blend_scale(rgb, px[3]);
+    }
+    *width = w;
+    *height = h;
+    return pixels;
+bad:
+    free(pixels);
+    return NULL;
+}
+
+/* Public: Decode a PPM (P6) or QOI image, told apart by their magic, into
+   0x00RRGGBB pixels.  Returns a malloc'd array, or NULL if the data is not
+   a supported image. */
+uint32_t *wallpaper_decode(const uint8_t *data, size_t size, int *width, int *height) {
+    if (size >= 4 && memcmp(data, "qoif", 4) == 0)
+        return wallpaper_decode_qoi(data, size, width, height);
+    if (size >= 3 && data[0] == 'P' && data[1] == '6')
+        return wallpaper_decode_ppm(data, size, width, height);
+    return NULL;
+}
+
+/* Internal: Halve a region of an image with a 2x2 box filter, all four
+   channels in two SWAR sums */
+static uint32_t *wallpaper_halve(const uint32_t *src, int stride, int x, int y, int w, int h) {
+    int hw = w / 2, hh = h / 2;
+    uint32_t *dst = malloc((size_t)hw * hh * 4);
+    if (!dst)
+        return NULL;
+    for (int row = 0; row < hh; row++) {
+        const uint32_t *a = src + (size_t)(y + 2 * row) * stride + x, *b = a + stride;
+        uint32_t *out = dst + (size_t)row * hw;
+        for (int col = 0; col < hw; col++, a += 2, b += 2) {
+            uint32_t rb = (a[0] & 0x00FF00FF) + (a[1] & 0x00FF00FF) +
+                          (b[0] & 0x00FF00FF) + (b[1] & 0x00FF00FF) + 0x00020002;
+            uint32_t ag = ((a[0] >> 8) & 0x00FF00FF) + ((a[1] >> 8) & 0x00FF00FF) +
+                          ((b[0] >> 8) & 0x00FF00FF) + ((b[1] >> 8) & 0x00FF00FF) + 0x00020002;
+            out[col] = ((rb >> 2) & 0x00FF00FF) | ((ag << 6) & 0xFF00FF00);
+        }
+    }
+    return dst;
+}
+
+/* Internal: One source row resampled horizontally */
+static void wallpaper_hrow(uint32_t *dst, const uint32_t *src, const int *xi, const uint8_t *fx,
+                           int width, int last) {
+    for (int x = 0; x < width; x++) {
+        int i = xi[x];
+        dst[x] = fb_blend_lerp(src[i], src[i < last ? i + 1 : last], fx[x]);
+    }
+}
+
+/* Public: Scale an image to fill width x height, keeping its aspect ratio
+   and cropping the overflow equally from both sides.  Shrinking first
+   halves the image with a box filter until less than 2x remains, then
+   everything is bilinear: each source row is resampled horizontally once
+   and output rows are mixed from two of those by the blend engine. */
+int wallpaper_scale(uint32_t *dst, int width, int height, const uint32_t *src, int src_width,
+                    int src_height) {
+    int stride = src_width;
+    int cx = 0, cy = 0, cw = src_width, ch = src_height;
+    if ((int64_t)src_width * height > (int64_t)src_height * width)
+        cw = (int)((int64_t)src_height * width / height);
+    else
+        ch = (int)((int64_t)src_width * height / width);
+    cw = cw > 0 ? cw : 1;
+    ch = ch > 0 ? ch : 1;
+    cx = (src_width - cw) / 2;
+    cy = (src_height - ch) / 2;
+
+    uint32_t *halved = NULL;
+    while (cw >= 2 * width && ch >= 2 * height) {
+        uint32_t *next = wallpaper_halve(src, stride, cx, cy, cw, ch);
+        free(halved);
+        if (!next)
+            return -1;
+        halved = next;
+        src = halved;
+        stride = cw /= 2;
+        ch /= 2;
+        cx = cy = 0;
+    }
+
+    /* Pixel centres map to pixel centres; weights are 7-bit */
+    int *xi = malloc((size_t)width * sizeof(int));
+    uint8_t *fx = malloc(width);
+    uint32_t *rows = malloc((size_t)width * 2 * 4);
+    if (!xi || !fx || !rows) {
+        free(xi);
+        free(fx);
+        free(rows);
+        free(halved);
+        return -1;
+    }
+    int last = cx + cw - 1;
+    int64_t step = ((int64_t)cw << 16) / width;
+    for (int x = 0; x < width; x++) {
+        int64_t sx = step * x + step / 2 - 0x8000;
+        sx = sx < 0 ? 0 : sx;
+        xi[x] = cx + (int)(sx >> 16);
+        fx[x] = (uint8_t)((sx & 0xFFFF) >> 9);
+        if (xi[x] >= last) {
+            xi[x] = last;
+            fx[x] = 0;
+        }
+    }
+
+    void (*lerp)(uint32_t *, const uint32_t *, const uint32_t *, size_t, unsigned) =
+        fb_blend_engine()->lerp;
+    uint32_t *top = rows, *bottom = rows + width;
+    int top_y = -1, bottom_y = -1;
+    step = ((int64_t)ch << 16) / height;
+    for (int y = 0; y < height; y++) {
+        int64_t sy = step * y + step / 2 - 0x8000;
+        sy = sy < 0 ? 0 : sy;
+        int y0 = (int)(sy >> 16), y1 = y0 + 1;
+        unsigned fy = (unsigned)((sy & 0xFFFF) >> 9);
+        if (y0 >= ch - 1) {
+            y0 = y1 = ch - 1;
+            fy = 0;
+        }
+        if (y0 == bottom_y) {
+            uint32_t *t = top;
+            top = bottom;
+            bottom = t;
+            top_y = bottom_y;
+            bottom_y = -1;
+        }
+        if (y0 != top_y) {
+            wallpaper_hrow(top, src + (size_t)(cy + y0) * stride, xi, fx, width, last);
+            top_y = y0;
+        }
+        if (y1 != bottom_y) {
+            wallpaper_hrow(bottom, src + (size_t)(cy + y1) * stride, xi, fx, width, last);
+            bottom_y = y1;
+        }
+        lerp(dst + (size_t)y * width, top, bottom, width, fy);
+    }
+    free(xi);
+    free(fx);
+    free(rows);
+    free(halved);
+    return 0;
+}
+
+/* Internal: Convert a row of 0xRRGGBB pixels to the framebuffer's format */
+static void wallpaper_store_row(const framebuffer_t *fb, uint8_t *dst, const uint32_t *src, int n) {
+    const fb_format_t *f = &fb->format;
+    if (fb->bpp == 32 && f->red_offset == 16 && f->green_offset == 8 && f->blue_offset == 0) {
+        memcpy(dst, src, (size_t)n * 4);
+        return;
+    }
+    int bytes = f->bytes_per_pixel;
+    for (int i = 0; i < n; i++, dst += bytes) {
+        uint32_t pixel = fb_map_rgb(fb, src[i]);
+        memcpy(dst, &pixel, bytes);     /* little-endian, as fbdev lays it out */
+    }
+}
+
+/* Internal: The header a cache file for this source and screen must have;
+   the source hash is filled in once it is known */
+static void wallpaper_header(wallpaper_header_t *h, const framebuffer_t *fb, const struct stat *st) {
+    memset(h, 0, sizeof(*h));
+    memcpy(h->magic, WALLPAPER_MAGIC, sizeof(h->magic));
+    h->width = fb->width;
+    h->height = fb->height;
+    h->bytes_per_pixel = fb->format.bytes_per_pixel;
+    h->red_offset = fb->format.red_offset;
+    h->red_length = fb->format.red_length;
+    h->green_offset = fb->format.green_offset;
+    h->green_length = fb->format.green_length;
+    h->blue_offset = fb->format.blue_offset;
+    h->blue_length = fb->format.blue_length;
+    h->stat.dev = st->st_dev;
+    h->stat.ino = st->st_ino;
+    h->stat.size = st->st_size;
+    h->stat.mtime = st->st_mtim.tv_sec;
+    h->stat.mtime_nsec = st->st_mtim.tv_nsec;
+}
+
+/* Internal: Point the layer at the pixels after the header */
+static void wallpaper_attach(wallpaper_t *wp, const framebuffer_t *fb, void *data, size_t size,
+                             int mapped) {
+    wp->data = data;
+    wp->size = size;
+    wp->mapped = mapped;
+    wp->layer.pixels = (uint8_t *)data + sizeof(wallpaper_header_t);
+    wp->layer.width = fb->width;
+    wp->layer.height = fb->height;
+    wp->layer.stride = (size_t)fb->width * fb->format.bytes_per_pixel;
+}
+
+/* Internal: Map a cache file if it was made for this screen, whatever the
+   source; the caller decides whether that still matches */
+static int wallpaper_map_cache(wallpaper_t *wp, const framebuffer_t *fb, const char *path,
+                               const wallpaper_header_t *expect, size_t size) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    struct stat st;
+    void *data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && (size_t)st.st_size == size)
+        data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return -1;
+    if (memcmp(data, expect, offsetof(wallpaper_header_t, source)) != 0) {
+        munmap(data, size);
+        return -1;
+    }
+    wallpaper_attach(wp, fb, data, size, 1);
+    return 0;
+}
+
+/* Internal: Update the header of a cache file whose source was touched but
+   not changed.  A torn write only makes the next start hash again. */
+static void wallpaper_touch_cache(const char *path, const wallpaper_header_t *h) {
+    int fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (fd < 0)
+        return;
+    if (pwrite(fd, h, sizeof(*h), 0) != (ssize_t)sizeof(*h))
+        perror(path);
+    close(fd);
+}
+
+/* Internal: Write a cache file atomically (a temporary file renamed into
+   place), then remove what older versions left for the same screen.
+   Failing is harmless; the next start just scales again. */
+static void wallpaper_write_cache(const char *path, const char *suffix, const void *data,
+                                  size_t size) {
+    if (mkdir(WALLPAPER_CACHE_DIR, 0755) < 0 && errno != EEXIST)
+        return;
+    char tmp[576];
+    snprintf(tmp, sizeof(tmp), "%s.%d.tmp", path, (int)getpid());
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        perror(tmp);
+        return;
+    }
+    const uint8_t *p = data;
+    size_t left = size;
+    while (left > 0) {
+        ssize_t n = write(fd, p, left);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        p += n;
+        left -= n;
+    }
+    if (close(fd) < 0 || left > 0 || rename(tmp, path) < 0) {
+        perror(tmp);
+        unlink(tmp);
+        return;
+    }
+
+    DIR *dir = opendir(WALLPAPER_CACHE_DIR);
+    if (!dir)
+        return;
+    const char *name = strrchr(path, '/') + 1;
+    size_t suffix_len = strlen(suffix);
+    for (struct dirent *e; (e = readdir(dir));) {
+        size_t len = strlen(e->d_name);
+        if (len > suffix_len && strcmp(e->d_name + len - suffix_len, suffix) == 0 &&
+            strcmp(e->d_name, name) != 0)
+            unlinkat(dirfd(dir), e->d_name, 0);
+    }
+    closedir(dir);
+}
+
+/* Public: Get the wallpaper at path for a screen.  The cache is looked up
+   by resolution and pixel format and used as is while the source's device,
+   inode, size and mtime match its header.  Otherwise, and only if build is
+   set, the source is read: when its hash still matches only the header is
+   updated, else it is decoded, scaled and converted now and the result
+   cached for next time.  Returns 0, or -1 when there is no wallpaper (no
+   source, a bad one, or nothing up to date cached and build unset). */
+int wallpaper_open(wallpaper_t *wp, const char *path, const framebuffer_t *fb, int build) {
+    memset(wp, 0, sizeof(*wp));
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno != ENOENT)
+            perror(path);
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        close(fd);
+        return -1;
+    }
+
+    wallpaper_header_t h;
+    wallpaper_header(&h, fb, &st);
+    char suffix[96], cache[512];
+    snprintf(suffix, sizeof(suffix), "-%dx%d-%d-%u.%u.%u.fbw", fb->width, fb->height, fb->bpp,
+             h.red_offset, h.green_offset, h.blue_offset);
+    snprintf(cache, sizeof(cache), WALLPAPER_CACHE_DIR "/wallpaper%s", suffix);
+    size_t size = sizeof(h) + (size_t)fb->width * fb->height * h.bytes_per_pixel;
+    wallpaper_map_cache(wp, fb, cache, &h, size);
+    const wallpaper_header_t *cached = wp->data;
+    if (cached && memcmp(&cached->stat, &h.stat, sizeof(h.stat)) == 0) {
+        close(fd);
+        return 0;
+    }
+    if (!build) {
+        close(fd);
+        wallpaper_close(wp);
+        return -1;
+    }
+
+    void *src = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (src == MAP_FAILED) {
+        wallpaper_close(wp);
+        return -1;
+    }
+    h.source = wallpaper_hash(src, st.st_size);
+    if (cached && cached->source == h.source) {
+        munmap(src, st.st_size);
+        wallpaper_touch_cache(cache, &h);
+        return 0;
+    }
+    wallpaper_close(wp);
+
+    int sw, sh;
+    uint32_t *image = wallpaper_decode(src, st.st_size, &sw, &sh);
+    munmap(src, st.st_size);
+    if (!image) {
+        fprintf(stderr, "Invalid wallpaper %s\n", path);
+        return -1;
+    }
+    uint32_t *scaled = malloc((size_t)fb->width * fb->height * 4);
+    uint8_t *data = malloc(size);
+    if (!scaled || !data || wallpaper_scale(scaled, fb->width, fb->height, image, sw, sh) < 0) {
+        free(image);
+        free(scaled);
+        free(data);
+        return -1;
+    }
+    free(image);
+    memcpy(data, &h, sizeof(h));
+    wallpaper_attach(wp, fb, data, size, 0);
+    for (int y = 0; y < fb->height; y++)
+        wallpaper_store_row(fb, wp->layer.pixels + (size_t)y * wp->layer.stride,
+                            scaled + (size_t)y * fb->width, fb->width);
+    free(scaled);
+    wallpaper_write_cache(cache, suffix, data, size);
+    return 0;
+}
+
+/* Public: Release a wallpaper from wallpaper_open() (safe to repeat) */
+void wallpaper_close(wallpaper_t *wp) {
+    if (wp->mapped)
+        munmap(wp->data, wp->size);
+    else
+        free(wp->data);
+    memset(wp, 0, sizeof(*wp));
+}
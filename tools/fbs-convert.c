@@ -0,0 +1,125 @@
+#include "sprite.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Convert a PAM (P7, RGB or RGB_ALPHA) or PPM (P6) image to an fblogin
+   sprite.  Transparent runs are run-length encoded whenever that makes the
+   file smaller.  Images with other formats can be brought over with e.g.
+   `magick in.png out.pam`. */
+
+/* Internal: Read the next header token, skipping comments */
+static int read_token(FILE *fp, char *buf, size_t size) {
+    int c;
+    do {
+        c = fgetc(fp);
+        if (c == '#')
+            while (c != '\n' && c != EOF)
+                c = fgetc(fp);
+    } while (c == ' ' || c == '\t' || c == '\n' || c == '\r');
+    size_t n = 0;
+    while (c != EOF && c != ' ' && c != '\t' && c != '\n' && c != '\r') {
+        if (n + 1 < size)
+            buf[n++] = (char)c;
+        c = fgetc(fp);
+    }
+    buf[n] = '\0';
+    return n > 0 ? 0 : -1;
+}
+
+/* Internal: Load an image as straight 0xAARRGGBB pixels; NULL on error */
+static uint32_t *load_image(const char *path, int *width, int *height) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        perror(path);
+        return NULL;
+    }
+    char tok[64];
+    int depth = 3, maxval = 0;
+    *width = *height = 0;
+    if (read_token(fp, tok, sizeof(tok)) < 0)
+        goto bad;
+    if (strcmp(tok, "P6") == 0) {
+        if (read_token(fp, tok, sizeof(tok)) < 0 || (*width = atoi(tok)) <= 0 ||
+            read_token(fp, tok, sizeof(tok)) < 0 || (*height = atoi(tok)) <= 0 ||
+            read_token(fp, tok, sizeof(tok)) < 0)
+            goto bad;
+        maxval = atoi(tok);
+    } else if (strcmp(tok, "P7") == 0) {
+        while (read_token(fp, tok, sizeof(tok)) == 0 && strcmp(tok, "ENDHDR") != 0) {
+            char val[64];
+            if (read_token(fp, val, sizeof(val)) < 0)
+                goto bad;
+            if (strcmp(tok, "WIDTH") == 0)
+                *width = atoi(val);
+            else if (strcmp(tok, "HEIGHT") == 0)
+                *height = atoi(val);
+            else if (strcmp(tok, "DEPTH") == 0)
+                depth = atoi(val);
+            else if (strcmp(tok, "MAXVAL") == 0)
+                maxval = atoi(val);
+        }
+    } else {
+        goto bad;
+    }
+    if (maxval != 255 || (depth != 3 && depth != 4) || *width <= 0 || *height <= 0 ||
+        *width > SPRITE_MAX_SIZE || *height > SPRITE_MAX_SIZE)
+        goto bad;
+
+    size_t count = (size_t)*width * *height;
+    uint32_t *argb = malloc(count * sizeof(*argb));
+    unsigned char px[4] = { 0, 0, 0, 255 };
+    for (size_t i = 0; argb && i < count; i++) {
+        if (fread(px, 1, depth, fp) != (size_t)depth) {
+            free(argb);
+            goto bad;
+        }
+        argb[i] = (uint32_t)px[3] << 24 | px[0] << 16 | px[1] << 8 | px[2];
+    }
+    fclose(fp);
+    return argb;
+
+bad:
+    fprintf(stderr, "%s: not an 8-bit PPM (P6) or RGB/RGB_ALPHA PAM (P7) image\n", path);
+    fclose(fp);
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    int force_raw = 0;
+    int arg = 1;
+    if (arg < argc && strcmp(argv[arg], "--raw") == 0) {
+        force_raw = 1;
+        arg++;
+    }
+    if (argc - arg != 2) {
+        fprintf(stderr, "Usage: %s [--raw] input.pam|input.ppm output.fbs\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    int width, height;
+    uint32_t *argb = load_image(argv[arg], &width, &height);
+    if (!argb)
+        return EXIT_FAILURE;
+
+    uint8_t *raw = NULL, *rle = NULL;
+    size_t raw_size = sprite_encode(argb, width, height, 0, &raw);
+    size_t rle_size = force_raw ? 0 : sprite_encode(argb, width, height, 1, &rle);
+    free(argb);
+    if (!raw_size) {
+        fprintf(stderr, "Out of memory\n");
+        return EXIT_FAILURE;
+    }
+    int use_rle = rle_size && rle_size < raw_size;
+    const uint8_t *out = use_rle ? rle : raw;
+    size_t size = use_rle ? rle_size : raw_size;
+
+    FILE *fp = fopen(argv[arg + 1], "wb");
+    if (!fp || fwrite(out, 1, size, fp) != size || fclose(fp) != 0) {
+        perror(argv[arg + 1]);
+        return EXIT_FAILURE;
+    }
+    printf("%s: %dx%d, %s, %zu bytes\n", argv[arg + 1], width, height, use_rle ? "rle" : "raw", size);
+    free(raw);
+    free(rle);
+    return 0;
+}